@@ -4,7 +4,10 @@
 
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iosched.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block {
@@ -19,8 +22,15 @@ struct block {
 
     unsigned long long             read_cnt;  /* Number of sectors read. */
     unsigned long long             write_cnt; /* Number of sectors written. */
+
+    struct iosched_queue           queue;       /* Requests waiting for the I/O thread. */
+    struct lock                    queue_lock;  /* Protects QUEUE. */
+    struct condition               queue_ready; /* Signaled when QUEUE gains a request. */
 };
 
+/* Most sectors the I/O thread merges into one transfer. */
+#define MERGE_MAX_SECTORS 64
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER(all_blocks);
 
@@ -28,6 +38,7 @@ static struct list all_blocks = LIST_INITIALIZER(all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block(struct list_elem *);
+static void block_io_thread(void *block_);
 
 /* Returns a human-readable name for the given block device
  * TYPE. */
@@ -112,6 +123,73 @@ check_sector(struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are all
+ * within BLOCK.  Panics if not. */
+static void
+check_sectors(struct block *block, block_sector_t sector, size_t cnt)
+{
+    check_sector(block, sector);
+    if (cnt > block->size - sector) {
+        check_sector(block, block->size);
+    }
+}
+
+/* Queues REQ for BLOCK and returns without waiting for it.
+ * REQ->done is called once the transfer is finished.  The I/O
+ * scheduler may reorder requests, so a caller must not have
+ * requests for overlapping sectors outstanding at once. */
+void
+block_submit(struct block *block, struct block_request *req)
+{
+    ASSERT(req->cnt > 0);
+
+    check_sectors(block, req->sector, req->cnt);
+    if (req->write) {
+        ASSERT(block->type != BLOCK_FOREIGN);
+        block->write_cnt += req->cnt;
+    } else {
+        block->read_cnt += req->cnt;
+    }
+
+    if (block->ops->submit != NULL) {
+        block->ops->submit(block->aux, req);
+        return;
+    }
+
+    lock_acquire(&block->queue_lock);
+    iosched_add(&block->queue, req);
+    cond_signal(&block->queue_ready, &block->queue_lock);
+    lock_release(&block->queue_lock);
+}
+
+/* Completion function for block_transfer(): wakes up the
+ * waiting thread. */
+static void
+wake_waiter(struct block_request *req)
+{
+    sema_up(req->aux);
+}
+
+/* Submits a request for CNT sectors starting at SECTOR on BLOCK
+ * and waits for it to finish. */
+static void
+block_transfer(struct block *block, block_sector_t sector, size_t cnt,
+               void *buffer, bool write)
+{
+    struct block_request req;
+    struct semaphore done;
+
+    sema_init(&done, 0);
+    req.sector = sector;
+    req.cnt = cnt;
+    req.buffer = buffer;
+    req.write = write;
+    req.done = wake_waiter;
+    req.aux = &done;
+    block_submit(block, &req);
+    sema_down(&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
  * have room for BLOCK_SECTOR_SIZE bytes.
  * Internally synchronizes accesses to block devices, so external
@@ -119,9 +197,7 @@ check_sector(struct block *block, block_sector_t sector)
 void
 block_read(struct block *block, block_sector_t sector, void *buffer)
 {
-    check_sector(block, sector);
-    block->ops->read(block->aux, sector, buffer);
-    block->read_cnt++;
+    block_transfer(block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -132,10 +208,162 @@ block_read(struct block *block, block_sector_t sector, void *buffer)
 void
 block_write(struct block *block, block_sector_t sector, const void *buffer)
 {
-    check_sector(block, sector);
-    ASSERT(block->type != BLOCK_FOREIGN);
-    block->ops->write(block->aux, sector, buffer);
-    block->write_cnt++;
+    block_transfer(block, sector, 1, (void *)buffer, true);
+}
+
+/* Reads CNT contiguous sectors starting at SECTOR from BLOCK
+ * into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+ * bytes.
+ * Internally synchronizes accesses to block devices, so external
+ * per-block device locking is unneeded. */
+void
+block_read_multi(struct block *block, block_sector_t sector, size_t cnt,
+                 void *buffer)
+{
+    if (cnt > 0) {
+        block_transfer(block, sector, cnt, buffer, false);
+    }
+}
+
+/* Writes CNT contiguous sectors starting at SECTOR to BLOCK from
+ * BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+ * Returns after the block device has acknowledged receiving all
+ * of the data.
+ * Internally synchronizes accesses to block devices, so external
+ * per-block device locking is unneeded. */
+void
+block_write_multi(struct block *block, block_sector_t sector, size_t cnt,
+                  const void *buffer)
+{
+    if (cnt > 0) {
+        block_transfer(block, sector, cnt, (void *)buffer, true);
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+ * BUFFER with the driver's operations, using its multi-sector
+ * operation if it has one and otherwise going one sector at a
+ * time. */
+static void
+block_do_transfer(struct block *block, block_sector_t sector, size_t cnt,
+                  uint8_t *buffer, bool write)
+{
+    const struct block_operations *ops = block->ops;
+    size_t i;
+
+    if (write && ops->write_multi != NULL) {
+        ops->write_multi(block->aux, sector, cnt, buffer);
+    } else if (!write && ops->read_multi != NULL) {
+        ops->read_multi(block->aux, sector, cnt, buffer);
+    } else {
+        for (i = 0; i < cnt; i++) {
+            if (write) {
+                ops->write(block->aux, sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+            } else {
+                ops->read(block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+            }
+        }
+    }
+}
+
+/* Carries out BATCH, a list of requests in one direction that
+ * cover a contiguous run of sectors on BLOCK, as one transfer.
+ * The buffers of merged requests are not contiguous in memory, so
+ * they are handed to the driver as a list of segments if it can
+ * take one, and otherwise go through BOUNCE, which has room for
+ * MERGE_MAX_SECTORS sectors. */
+static void
+block_do_batch(struct block *block, struct list *batch, uint8_t *bounce)
+{
+    struct block_request *first = list_entry(list_front(batch),
+                                             struct block_request, elem);
+    struct list_elem *e;
+    size_t cnt = 0;
+
+    if (list_next(&first->elem) == list_end(batch)) {
+        block_do_transfer(block, first->sector, first->cnt, first->buffer,
+                          first->write);
+        return;
+    }
+
+    if (block->ops->transfer_segs != NULL) {
+        struct block_segment segs[MERGE_MAX_SECTORS];
+        size_t seg_cnt = 0;
+
+        for (e = list_begin(batch); e != list_end(batch); e = list_next(e)) {
+            struct block_request *req = list_entry(e, struct block_request,
+                                                   elem);
+
+            ASSERT(seg_cnt < MERGE_MAX_SECTORS);
+            segs[seg_cnt].buffer = req->buffer;
+            segs[seg_cnt].cnt = req->cnt;
+            seg_cnt++;
+        }
+        block->ops->transfer_segs(block->aux, first->sector, segs, seg_cnt,
+                                  first->write);
+        return;
+    }
+
+    for (e = list_begin(batch); e != list_end(batch); e = list_next(e)) {
+        struct block_request *req = list_entry(e, struct block_request, elem);
+
+        if (req->write) {
+            memcpy(bounce + cnt * BLOCK_SECTOR_SIZE, req->buffer,
+                   req->cnt * BLOCK_SECTOR_SIZE);
+        }
+        cnt += req->cnt;
+    }
+    ASSERT(cnt <= MERGE_MAX_SECTORS);
+
+    block_do_transfer(block, first->sector, cnt, bounce, first->write);
+
+    if (!first->write) {
+        cnt = 0;
+        for (e = list_begin(batch); e != list_end(batch); e = list_next(e)) {
+            struct block_request *req = list_entry(e, struct block_request,
+                                                   elem);
+
+            memcpy(req->buffer, bounce + cnt * BLOCK_SECTOR_SIZE,
+                   req->cnt * BLOCK_SECTOR_SIZE);
+            cnt += req->cnt;
+        }
+    }
+}
+
+/* I/O thread for BLOCK: takes batches of requests from the I/O
+ * scheduler, carries each out, and reports its requests done. */
+static void
+block_io_thread(void *block_)
+{
+    struct block *block = block_;
+    bool segs = block->ops->transfer_segs != NULL;
+    uint8_t *bounce = segs ? NULL
+                           : malloc(MERGE_MAX_SECTORS * BLOCK_SECTOR_SIZE);
+
+    for (;;) {
+        struct list batch;
+
+        list_init(&batch);
+        lock_acquire(&block->queue_lock);
+        while (iosched_empty(&block->queue)) {
+            cond_wait(&block->queue_ready, &block->queue_lock);
+        }
+        iosched_next(&block->queue, &batch,
+                     segs || bounce != NULL ? MERGE_MAX_SECTORS : 0);
+        lock_release(&block->queue_lock);
+
+        block_do_batch(block, &batch, bounce);
+        while (!list_empty(&batch)) {
+            struct block_request *req = list_entry(list_pop_front(&batch),
+                                                   struct block_request, elem);
+
+            if (req->done != NULL) {
+                req->done(req);
+            }
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -199,6 +427,9 @@ block_register(const char *name, enum block_type type,
     block->aux = aux;
     block->read_cnt = 0;
     block->write_cnt = 0;
+    iosched_init(&block->queue);
+    lock_init(&block->queue_lock);
+    cond_init(&block->queue_ready);
 
     printf("%s: %'"PRDSNu " sectors (", block->name, block->size);
     print_human_readable_size((uint64_t)block->size * BLOCK_SECTOR_SIZE);
@@ -208,6 +439,12 @@ block_register(const char *name, enum block_type type,
     }
     printf("\n");
 
+    /* Devices that pass their requests on need no thread of
+     * their own. */
+    if (ops->submit == NULL) {
+        thread_create(block->name, PRI_MAX, block_io_thread, block);
+    }
+
     return block;
 }
 
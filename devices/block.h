@@ -2,6 +2,8 @@
 #define DEVICES_BLOCK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 /* Size of a block device sector in bytes.
@@ -51,17 +53,70 @@ struct block *block_next(struct block *);
 block_sector_t block_size(struct block *);
 void block_read(struct block *, block_sector_t, void *);
 void block_write(struct block *, block_sector_t, const void *);
+void block_read_multi(struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multi(struct block *, block_sector_t, size_t cnt,
+                       const void *);
 const char *block_name(struct block *);
 enum block_type block_type(struct block *);
 
+/* An asynchronous request to read or write a run of sectors.
+ * The submitter fills in the members up to AUX, then leaves the
+ * request and its buffer alone until DONE is called. */
+struct block_request {
+    block_sector_t   sector; /* First sector.  Remapped in place by
+                              * stacked devices such as partitions. */
+    size_t           cnt;    /* Number of sectors. */
+    void            *buffer; /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool             write;  /* Write BUFFER rather than read into it? */
+
+    /* Called once the transfer is finished, from the device's I/O
+     * thread, so it must not sleep.  May be null. */
+    void           (*done) (struct block_request *);
+    void            *aux;    /* For DONE's use. */
+
+    /* Owned by the I/O scheduler. */
+    struct list_elem elem;      /* Element in the device's queue. */
+    struct list_elem fifo_elem; /* Element in the deadline list. */
+    int64_t          deadline;  /* Timer tick to serve it by. */
+};
+
+void block_submit(struct block *, struct block_request *);
+
 /* Statistics. */
 void block_print_stats(void);
 
 /* Lower-level interface to block device drivers. */
 
+/* One piece of memory in a scattered transfer. */
+struct block_segment {
+    void  *buffer; /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    size_t cnt;    /* Number of sectors. */
+};
+
 struct block_operations {
+    /* May be null if SUBMIT is provided. */
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT contiguous sectors in one go.  If
+     * null, READ or WRITE is called once per sector instead. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *buffer);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *buffer);
+
+    /* Optional.  Takes over a request submitted to this device,
+     * e.g. to pass it on to another device, instead of having it
+     * queued for the device's I/O thread. */
+    void (*submit) (void *aux, struct block_request *);
+
+    /* Optional.  Transfer a contiguous run of sectors to or from
+     * SEG_CNT pieces of memory, in order, in one go, e.g. with a
+     * scatter/gather DMA list.  If null, merged requests are moved
+     * through a bounce buffer instead. */
+    void (*transfer_segs) (void *aux, block_sector_t,
+                           const struct block_segment *, size_t seg_cnt,
+                           bool write);
 };
 
 struct block *block_register(const char *name, enum block_type,
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "devices/block.h"
 #include "devices/ide.h"
@@ -9,7 +10,9 @@
 #include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
  * controller.  It attempts to comply to [ATA-3]. */
@@ -31,10 +34,29 @@
 #define reg_ctl(CHANNEL)        ((CHANNEL)->reg_base + 0x206) /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl(CHANNEL)              /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to a channel's
+ * bus master base.  (Only valid if bm_base is nonzero.) */
+#define reg_bm_cmd(CHANNEL)    ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2) /* Status. */
+#define reg_bm_prdt(CHANNEL)   ((CHANNEL)->bm_base + 4) /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_START 0x01 /* Start transfer. */
+#define BM_READ  0x08 /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR  0x02 /* Error. */
+#define BM_STA_INTR 0x04 /* Interrupt. */
+
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
 /* Alternate Status Register bits. */
 #define STA_BSY  0x80 /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ  0x08 /* Data Request. */
+#define STA_ERR  0x01 /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -50,6 +72,14 @@
 #define CMD_IDENTIFY_DEVICE    0xec /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY  0x20 /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE      0xc4 /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE     0xc5 /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE  0xc6 /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA           0xc8 /* READ DMA. */
+#define CMD_WRITE_DMA          0xca /* WRITE DMA. */
+
+/* Most sectors a single READ or WRITE SECTOR command can cover. */
+#define IDE_MAX_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk {
@@ -57,8 +87,22 @@ struct ata_disk {
     struct channel *channel; /* Channel that disk is attached to. */
     int             dev_no;  /* Device 0 or 1 for master or slave. */
     bool            is_ata;  /* Is device an ATA disk? */
+    size_t          multiple; /* Sectors per interrupt under READ/WRITE
+                               * MULTIPLE, or 0 if not in use. */
+    bool            dma;     /* Use bus master DMA? */
 };
 
+/* A physical region descriptor, one entry in the table that tells
+ * the bus master where in memory a DMA transfer goes. */
+struct prd {
+    uint32_t addr;  /* Physical address of the region. */
+    uint16_t size;  /* Size of the region in bytes, 0 meaning 64 kB. */
+    uint16_t flags; /* PRD_EOT on the last entry. */
+};
+
+#define PRD_EOT 0x8000                          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))  /* Entries per table. */
+
 /* An ATA channel (aka controller).
  * Each channel can control up to two disks. */
 struct channel {
@@ -71,6 +115,10 @@ struct channel {
                                            * any interrupt would be spurious. */
     struct semaphore completion_wait;     /* Up'd by interrupt handler. */
 
+    uint16_t         bm_base;             /* Bus master base port, or 0 if
+                                           * the channel can't do DMA. */
+    struct prd      *prdt;                /* PRD table, one page. */
+
     struct ata_disk  devices[2];          /* The devices on this channel. */
 };
 
@@ -80,11 +128,16 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master(void);
 static void reset_channel(struct channel *);
 static bool check_device_type(struct ata_disk *);
 static void identify_ata_device(struct ata_disk *);
+static void set_multiple_mode(struct ata_disk *, size_t max);
 
-static void select_sector(struct ata_disk *, block_sector_t);
+static void select_sector(struct ata_disk *, block_sector_t, size_t cnt);
+static bool dma_transfer(struct ata_disk *, block_sector_t,
+                         const struct block_segment *, size_t seg_cnt,
+                         bool write);
 
 static void issue_pio_command(struct channel *, uint8_t command);
 
@@ -103,6 +156,7 @@ static void interrupt_handler(struct intr_frame *);
 void
 ide_init(void)
 {
+    uint16_t bm_base = find_bus_master();
     size_t chan_no;
 
     for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -127,6 +181,16 @@ ide_init(void)
         c->expecting_interrupt = false;
         sema_init(&c->completion_wait, 0);
 
+        /* Channel 1's bus master registers follow channel 0's. */
+        c->bm_base = 0;
+        c->prdt = NULL;
+        if (bm_base != 0) {
+            c->prdt = palloc_get_page(0);
+            if (c->prdt != NULL) {
+                c->bm_base = bm_base + chan_no * 8;
+            }
+        }
+
         /* Initialize devices. */
         for (dev_no = 0; dev_no < 2; dev_no++) {
             struct ata_disk *d = &c->devices[dev_no];
@@ -135,6 +199,8 @@ ide_init(void)
             d->channel = c;
             d->dev_no = dev_no;
             d->is_ata = false;
+            d->multiple = 0;
+            d->dma = false;
         }
 
         /* Register interrupt handler. */
@@ -157,6 +223,70 @@ ide_init(void)
     }
 }
 
+/* Reads the 32-bit PCI configuration register REG of function
+ * FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config(int dev, int func, int reg)
+{
+    outl(PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+    return inl(PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit PCI configuration register REG of
+ * function FUNC of device DEV on bus 0. */
+static void
+pci_write_config(int dev, int func, int reg, uint32_t data)
+{
+    outl(PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+    outl(PCI_CONFIG_DATA, data);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can do bus master
+ * DMA and has both channels at the legacy ports, such as the
+ * PIIX3 or PIIX4 in a standard PC, and turns on bus mastering.
+ * Returns the base port of its bus master registers, or 0 if
+ * there is no such controller. */
+static uint16_t
+find_bus_master(void)
+{
+    int dev, func;
+
+    for (dev = 0; dev < 32; dev++) {
+        for (func = 0; func < 8; func++) {
+            uint32_t class, bar4;
+
+            if ((pci_read_config(dev, func, 0x00) & 0xffff) == 0xffff) {
+                continue;
+            }
+
+            /* Class 1, subclass 1 is IDE.  In the programming
+             * interface, bit 7 means bus master capable and bits 0
+             * and 2 mean a channel has moved off the legacy ports. */
+            class = pci_read_config(dev, func, 0x08);
+            if ((class >> 16) == 0x0101
+                && (class & 0x8000) != 0 && (class & 0x0500) == 0) {
+                bar4 = pci_read_config(dev, func, 0x20);
+                if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0) {
+                    continue;
+                }
+
+                /* Enable I/O space and bus mastering. */
+                pci_write_config(dev, func, 0x04,
+                                 (pci_read_config(dev, func, 0x04) & 0xffff)
+                                 | 0x05);
+                return bar4 & 0xfffc;
+            }
+
+            /* Single-function device. */
+            if (func == 0
+                && (pci_read_config(dev, func, 0x0c) & 0x800000) == 0) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string(char *, int size);
@@ -297,12 +427,59 @@ identify_ata_device(struct ata_disk *d)
         return;
     }
 
+    /* Word 47 gives the most sectors the disk can move per
+     * interrupt under READ/WRITE MULTIPLE. */
+    set_multiple_mode(d, (uint8_t)id[47 * 2]);
+    if (d->multiple > 0) {
+        size_t len = strlen(extra_info);
+        snprintf(extra_info + len, sizeof extra_info - len,
+                 ", multiple %zu", d->multiple);
+    }
+
+    /* Word 49 bit 8 says whether the disk supports DMA. */
+    d->dma = c->bm_base != 0 && (*(uint16_t *)&id[49 * 2] & 0x100) != 0;
+    if (d->dma) {
+        size_t len = strlen(extra_info);
+        snprintf(extra_info + len, sizeof extra_info - len, ", DMA");
+    }
+
     /* Register. */
     block = block_register(d->name, BLOCK_RAW, extra_info, capacity,
                            &ide_operations, d);
     partition_scan(block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D with the largest power of
+ * two no greater than MAX sectors per interrupt, and records it in
+ * D->multiple.  Leaves D->multiple at 0 if MAX is under 2 or the
+ * disk rejects the command, so that the driver keeps using one
+ * interrupt per sector. */
+static void
+set_multiple_mode(struct ata_disk *d, size_t max)
+{
+    struct channel *c = d->channel;
+    size_t cnt;
+
+    d->multiple = 0;
+    if (max < 2) {
+        return;
+    }
+    for (cnt = 1; cnt * 2 <= max; cnt *= 2) {
+        continue;
+    }
+
+    select_device_wait(d);
+    outb(reg_nsect(c), cnt);
+    issue_pio_command(c, CMD_SET_MULTIPLE_MODE);
+    sema_down(&c->completion_wait);
+    wait_until_idle(d);
+    if (inb(reg_status(c)) & STA_ERR) {
+        printf("%s: SET MULTIPLE MODE %zu rejected\n", d->name, cnt);
+        return;
+    }
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
  * format, into a null-terminated string in-place.  Drops
  * trailing whitespace and null bytes.  Returns STRING.  */
@@ -330,27 +507,128 @@ descramble_ata_string(char *string, int size)
     return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
- * room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER
+ * with PIO.  The disk interrupts once per D->multiple sectors if
+ * multiple mode is on, otherwise once per sector.
+ * D's channel must be locked. */
+static void
+pio_read(struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+         uint8_t *buffer)
+{
+    struct channel *c = d->channel;
+    size_t per_irq = d->multiple > 0 ? d->multiple : 1;
+    size_t i, j;
+
+    select_sector(d, sec_no, cnt);
+    issue_pio_command(c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                         : CMD_READ_SECTOR_RETRY);
+    for (i = 0; i < cnt; i += per_irq) {
+        sema_down(&c->completion_wait);
+        if (!wait_while_busy(d)) {
+            PANIC("%s: disk read failed, sector=%"PRDSNu,
+                  d->name, sec_no + i);
+        }
+        for (j = i; j < cnt && j < i + per_irq; j++) {
+            input_sector(c, buffer);
+            buffer += BLOCK_SECTOR_SIZE;
+        }
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER
+ * with PIO, a block of D->multiple sectors (or one sector) per
+ * interrupt.
+ * D's channel must be locked. */
+static void
+pio_write(struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          const uint8_t *buffer)
+{
+    struct channel *c = d->channel;
+    size_t per_irq = d->multiple > 0 ? d->multiple : 1;
+    size_t i, j;
+
+    select_sector(d, sec_no, cnt);
+    issue_pio_command(c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                         : CMD_WRITE_SECTOR_RETRY);
+    for (i = 0; i < cnt; i += per_irq) {
+        if (!wait_while_busy(d)) {
+            PANIC("%s: disk write failed, sector=%"PRDSNu,
+                  d->name, sec_no + i);
+        }
+        for (j = i; j < cnt && j < i + per_irq; j++) {
+            output_sector(c, buffer);
+            buffer += BLOCK_SECTOR_SIZE;
+        }
+        sema_down(&c->completion_wait);
+    }
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+ * which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+ * command covers up to IDE_MAX_SECTORS sectors, moved by DMA if
+ * possible and by PIO otherwise.
  * Internally synchronizes accesses to disks, so external
  * per-disk locking is unneeded. */
 static void
-ide_read(void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi(void *d_, block_sector_t sec_no, size_t cnt, void *buffer_)
 {
     struct ata_disk *d = d_;
     struct channel *c = d->channel;
+    uint8_t *buffer = buffer_;
 
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
-    issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-    sema_down(&c->completion_wait);
-    if (!wait_while_busy(d)) {
-        PANIC("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+    while (cnt > 0) {
+        size_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+        struct block_segment seg = { buffer, chunk };
+
+        if (!dma_transfer(d, sec_no, &seg, 1, false)) {
+            pio_read(d, sec_no, chunk, buffer);
+        }
+        buffer += chunk * BLOCK_SECTOR_SIZE;
+        sec_no += chunk;
+        cnt -= chunk;
+    }
+    lock_release(&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+ * which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+ * after the disk has acknowledged receiving all of the data.
+ * Internally synchronizes accesses to disks, so external
+ * per-disk locking is unneeded. */
+static void
+ide_write_multi(void *d_, block_sector_t sec_no, size_t cnt,
+                const void *buffer_)
+{
+    struct ata_disk *d = d_;
+    struct channel *c = d->channel;
+    const uint8_t *buffer = buffer_;
+
+    lock_acquire(&c->lock);
+    while (cnt > 0) {
+        size_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+        struct block_segment seg = { (void *)buffer, chunk };
+
+        if (!dma_transfer(d, sec_no, &seg, 1, true)) {
+            pio_write(d, sec_no, chunk, buffer);
+        }
+        buffer += chunk * BLOCK_SECTOR_SIZE;
+        sec_no += chunk;
+        cnt -= chunk;
     }
-    input_sector(c, buffer);
     lock_release(&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+ * room for BLOCK_SECTOR_SIZE bytes.
+ * Internally synchronizes accesses to disks, so external
+ * per-disk locking is unneeded. */
+static void
+ide_read(void *d_, block_sector_t sec_no, void *buffer)
+{
+    ide_read_multi(d_, sec_no, 1, buffer);
+}
+
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
  * BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
  * acknowledged receiving the data.
@@ -358,39 +636,71 @@ ide_read(void *d_, block_sector_t sec_no, void *buffer)
  * per-disk locking is unneeded. */
 static void
 ide_write(void *d_, block_sector_t sec_no, const void *buffer)
+{
+    ide_write_multi(d_, sec_no, 1, buffer);
+}
+
+/* Moves the SEG_CNT pieces of memory in SEGS to or from the run of
+ * sectors starting at SEC_NO on disk D, in order.  If DMA can be
+ * used they go in a single command, with the bus master gathering
+ * or scattering them through the PRD table.  Otherwise each piece
+ * is its own transfer.
+ * Internally synchronizes accesses to disks, so external
+ * per-disk locking is unneeded. */
+static void
+ide_transfer_segs(void *d_, block_sector_t sec_no,
+                  const struct block_segment *segs, size_t seg_cnt,
+                  bool write)
 {
     struct ata_disk *d = d_;
     struct channel *c = d->channel;
+    size_t cnt = 0;
+    size_t i;
+    bool done;
 
-    lock_acquire(&c->lock);
-    select_sector(d, sec_no);
-    issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-    if (!wait_while_busy(d)) {
-        PANIC("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+    for (i = 0; i < seg_cnt; i++) {
+        cnt += segs[i].cnt;
     }
-    output_sector(c, buffer);
-    sema_down(&c->completion_wait);
+
+    lock_acquire(&c->lock);
+    done = cnt <= IDE_MAX_SECTORS
+           && dma_transfer(d, sec_no, segs, seg_cnt, write);
     lock_release(&c->lock);
+
+    for (i = 0; !done && i < seg_cnt; i++) {
+        if (write) {
+            ide_write_multi(d, sec_no, segs[i].cnt, segs[i].buffer);
+        } else {
+            ide_read_multi(d, sec_no, segs[i].cnt, segs[i].buffer);
+        }
+        sec_no += segs[i].cnt;
+    }
 }
 
 static struct block_operations ide_operations =
 {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi,
+    NULL,
+    ide_transfer_segs
 };
 
 /* Selects device D, waiting for it to become ready, and then
- * writes SEC_NO to the disk's sector selection registers.  (We
- * use LBA mode.) */
+ * writes SEC_NO and the sector count CNT to the disk's sector
+ * selection registers.  A CNT of IDE_MAX_SECTORS is sent as 0,
+ * which the disk takes to mean 256.  (We use LBA mode.) */
 static void
-select_sector(struct ata_disk *d, block_sector_t sec_no)
+select_sector(struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
     struct channel *c = d->channel;
 
     ASSERT(sec_no < (1UL << 28));
+    ASSERT(cnt > 0 && cnt <= IDE_MAX_SECTORS);
 
     select_device_wait(d);
-    outb(reg_nsect(c), 1);
+    outb(reg_nsect(c), cnt == IDE_MAX_SECTORS ? 0 : cnt);
     outb(reg_lbal(c), sec_no);
     outb(reg_lbam(c), sec_no >> 8);
     outb(reg_lbah(c), (sec_no >> 16));
@@ -398,6 +708,87 @@ select_sector(struct ata_disk *d, block_sector_t sec_no)
          DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
 }
 
+/* Moves the sectors starting at SEC_NO between disk D and the
+ * SEG_CNT pieces of memory in SEGS with bus master DMA, from the
+ * disk into them unless WRITE is true.  Each piece gets its own PRD
+ * entries, so they need not be contiguous.  Returns false without
+ * touching the disk if DMA can't be used for one of them.  If the
+ * transfer fails, also returns false and turns DMA off for D, so
+ * that the caller can redo it with PIO.
+ * D's channel must be locked. */
+static bool
+dma_transfer(struct ata_disk *d, block_sector_t sec_no,
+             const struct block_segment *segs, size_t seg_cnt, bool write)
+{
+    struct channel *c = d->channel;
+    uint8_t bm_cmd = write ? 0 : BM_READ;
+    size_t cnt = 0;
+    size_t prd_cnt = 0;
+    uint8_t bm_status;
+    size_t i;
+
+    ASSERT(lock_held_by_current_thread(&c->lock));
+    ASSERT(seg_cnt > 0);
+
+    /* The bus master needs word-aligned physical addresses. */
+    if (!d->dma) {
+        return false;
+    }
+    for (i = 0; i < seg_cnt; i++) {
+        if (!is_kernel_vaddr(segs[i].buffer)
+            || ((uintptr_t)segs[i].buffer & 1) != 0) {
+            return false;
+        }
+        cnt += segs[i].cnt;
+    }
+    ASSERT(cnt > 0 && cnt <= IDE_MAX_SECTORS);
+
+    /* Build the PRD table.  A region may not cross a 64 kB
+     * boundary. */
+    for (i = 0; i < seg_cnt; i++) {
+        uintptr_t addr = vtop(segs[i].buffer);
+        size_t left = segs[i].cnt * BLOCK_SECTOR_SIZE;
+
+        while (left > 0) {
+            size_t size = 0x10000 - (addr & 0xffff);
+
+            if (size > left) {
+                size = left;
+            }
+            ASSERT(prd_cnt < PRD_CNT);
+            c->prdt[prd_cnt].addr = addr;
+            c->prdt[prd_cnt].size = size & 0xffff;
+            c->prdt[prd_cnt].flags = 0;
+            prd_cnt++;
+            addr += size;
+            left -= size;
+        }
+    }
+    c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+    outb(reg_bm_cmd(c), bm_cmd);
+    outl(reg_bm_prdt(c), vtop(c->prdt));
+    outb(reg_bm_status(c), BM_STA_ERR | BM_STA_INTR);
+
+    select_sector(d, sec_no, cnt);
+    issue_pio_command(c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(reg_bm_cmd(c), bm_cmd | BM_START);
+    sema_down(&c->completion_wait);
+    outb(reg_bm_cmd(c), bm_cmd);
+
+    bm_status = inb(reg_bm_status(c));
+    outb(reg_bm_status(c), BM_STA_ERR | BM_STA_INTR);
+    if ((bm_status & BM_STA_ERR) != 0
+        || (inb(reg_alt_status(c)) & (STA_BSY | STA_ERR)) != 0) {
+        printf("%s: DMA failed, sector=%"PRDSNu", using PIO\n",
+               d->name, sec_no);
+        wait_until_idle(d);
+        d->dma = false;
+        return false;
+    }
+    return true;
+}
+
 /* Writes COMMAND to channel C and prepares for receiving a
  * completion interrupt. */
 static void
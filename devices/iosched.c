@@ -0,0 +1,209 @@
+#include <debug.h>
+#include <string.h>
+
+#include "devices/iosched.h"
+#include "devices/timer.h"
+
+/* How long a read or a write may wait, in timer ticks, before the
+ * C-LOOK policy serves it ahead of its turn. */
+#define READ_EXPIRE  (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* An I/O scheduling policy. */
+struct iosched {
+    const char *name;
+
+    /* Inserts REQ into Q->reqs. */
+    void (*add) (struct iosched_queue *q, struct block_request *req);
+
+    /* Returns the request in nonempty Q to dispatch next, without
+     * removing it. */
+    struct block_request *(*pick) (struct iosched_queue *q);
+};
+
+static const struct iosched noop_sched;
+static const struct iosched clook_sched;
+
+/* All the policies, the first one being the default. */
+static const struct iosched *const policies[] =
+{
+    &clook_sched,
+    &noop_sched,
+};
+
+/* -iosched: Policy given to block device queues. */
+static const struct iosched *policy = &clook_sched;
+
+/* Makes the policy called NAME the one used for block devices
+ * registered from now on.  Returns false if there is no such
+ * policy. */
+bool
+iosched_select(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof policies / sizeof *policies; i++) {
+        if (!strcmp(policies[i]->name, name)) {
+            policy = policies[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Initializes Q as an empty queue under the selected policy. */
+void
+iosched_init(struct iosched_queue *q)
+{
+    q->sched = policy;
+    list_init(&q->reqs);
+    list_init(&q->fifo);
+    q->head = 0;
+}
+
+/* Returns true if no requests are waiting in Q. */
+bool
+iosched_empty(struct iosched_queue *q)
+{
+    return list_empty(&q->reqs);
+}
+
+/* Orders requests by deadline. */
+static bool
+deadline_less(const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+    const struct block_request *a = list_entry(a_, struct block_request,
+                                               fifo_elem);
+    const struct block_request *b = list_entry(b_, struct block_request,
+                                               fifo_elem);
+
+    return a->deadline < b->deadline;
+}
+
+/* Adds REQ to Q, giving it a deadline. */
+void
+iosched_add(struct iosched_queue *q, struct block_request *req)
+{
+    req->deadline = timer_ticks() + (req->write ? WRITE_EXPIRE : READ_EXPIRE);
+    list_insert_ordered(&q->fifo, &req->fifo_elem, deadline_less, NULL);
+    q->sched->add(q, req);
+}
+
+/* Returns the request in Q that starts at SECTOR and goes in the
+ * direction given by WRITE, or a null pointer if there is none. */
+static struct block_request *
+find_at(struct iosched_queue *q, block_sector_t sector, bool write)
+{
+    struct list_elem *e;
+
+    for (e = list_begin(&q->reqs); e != list_end(&q->reqs); e = list_next(e)) {
+        struct block_request *req = list_entry(e, struct block_request, elem);
+
+        if (req->sector == sector && req->write == write) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+/* Removes REQ from Q and appends it to BATCH. */
+static void
+move_to_batch(struct block_request *req, struct list *batch)
+{
+    list_remove(&req->elem);
+    list_remove(&req->fifo_elem);
+    list_push_back(batch, &req->elem);
+}
+
+/* Moves the next request to dispatch from nonempty Q into BATCH,
+ * followed by any queued requests in the same direction that
+ * continue it sector for sector, as long as the batch stays
+ * within MAX_CNT sectors.  The first request is moved even if it
+ * alone is bigger than that. */
+void
+iosched_next(struct iosched_queue *q, struct list *batch, size_t max_cnt)
+{
+    struct block_request *req;
+    block_sector_t end;
+    size_t cnt;
+
+    ASSERT(!iosched_empty(q));
+
+    req = q->sched->pick(q);
+    move_to_batch(req, batch);
+    end = req->sector + req->cnt;
+    cnt = req->cnt;
+    for (;;) {
+        struct block_request *next = find_at(q, end, req->write);
+
+        if (next == NULL || cnt + next->cnt > max_cnt) {
+            break;
+        }
+        move_to_batch(next, batch);
+        end += next->cnt;
+        cnt += next->cnt;
+    }
+    q->head = end;
+}
+
+/* No-op policy: requests go out in the order they came in. */
+
+static void
+noop_add(struct iosched_queue *q, struct block_request *req)
+{
+    list_push_back(&q->reqs, &req->elem);
+}
+
+static struct block_request *
+noop_pick(struct iosched_queue *q)
+{
+    return list_entry(list_front(&q->reqs), struct block_request, elem);
+}
+
+static const struct iosched noop_sched = {"noop", noop_add, noop_pick};
+
+/* C-LOOK policy: the head sweeps toward higher sectors, serving
+ * requests as it passes them, then jumps back to the lowest
+ * waiting request.  A request whose deadline has passed is
+ * served first, so that a busy region of the disk can't starve
+ * the rest. */
+
+/* Orders requests by first sector. */
+static bool
+sector_less(const struct list_elem *a_, const struct list_elem *b_,
+            void *aux UNUSED)
+{
+    const struct block_request *a = list_entry(a_, struct block_request, elem);
+    const struct block_request *b = list_entry(b_, struct block_request, elem);
+
+    return a->sector < b->sector;
+}
+
+static void
+clook_add(struct iosched_queue *q, struct block_request *req)
+{
+    list_insert_ordered(&q->reqs, &req->elem, sector_less, NULL);
+}
+
+static struct block_request *
+clook_pick(struct iosched_queue *q)
+{
+    struct block_request *oldest = list_entry(list_front(&q->fifo),
+                                              struct block_request, fifo_elem);
+    struct list_elem *e;
+
+    if (timer_ticks() >= oldest->deadline) {
+        return oldest;
+    }
+    for (e = list_begin(&q->reqs); e != list_end(&q->reqs); e = list_next(e)) {
+        struct block_request *req = list_entry(e, struct block_request, elem);
+
+        if (req->sector >= q->head) {
+            return req;
+        }
+    }
+    return list_entry(list_front(&q->reqs), struct block_request, elem);
+}
+
+static const struct iosched clook_sched = {"clook", clook_add, clook_pick};
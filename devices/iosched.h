@@ -0,0 +1,35 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "devices/block.h"
+
+/* An I/O scheduler decides the order in which the requests queued
+ * for a block device reach its driver, and merges requests for
+ * adjacent sectors into one transfer.
+ *
+ * The policy is picked on the kernel command line with
+ * "-iosched=NAME" and applies to every block device.  The queue
+ * functions do no locking of their own. */
+
+/* Requests waiting for one block device. */
+struct iosched_queue {
+    const struct iosched *sched; /* Policy that orders this queue. */
+    struct list           reqs;  /* Requests, in the policy's order. */
+    struct list           fifo;  /* The same requests, earliest deadline
+                                  * first. */
+    block_sector_t        head;  /* Sector just past the last dispatch. */
+};
+
+bool iosched_select(const char *name);
+
+void iosched_init(struct iosched_queue *);
+bool iosched_empty(struct iosched_queue *);
+void iosched_add(struct iosched_queue *, struct block_request *);
+void iosched_next(struct iosched_queue *, struct list *batch,
+                  size_t max_cnt);
+
+#endif /* devices/iosched.h */
@@ -9,6 +9,7 @@ int
 main (int argc, char *argv[])
 {
   int in_fd, out_fd;
+  int size, copied, n;
 
   if (argc != 3)
     {
@@ -37,14 +38,13 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
-  /* Copy data. */
-  for (;;)
+  /* Copy data, inside the kernel.  A call may copy less than
+     asked for. */
+  size = filesize (in_fd);
+  for (copied = 0; copied < size; copied += n)
     {
-      char buffer[1024];
-      int bytes_read = read (in_fd, buffer, sizeof buffer);
-      if (bytes_read == 0)
-        break;
-      if (write (out_fd, buffer, bytes_read) != bytes_read)
+      n = copy_range (in_fd, copied, out_fd, copied, size - copied);
+      if (n <= 0)
         {
           printf ("%s: write failed\n", argv[2]);
           return EXIT_FAILURE;
@@ -0,0 +1,363 @@
+#include <debug.h>
+#include <string.h>
+
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#define LOGGING_LEVEL 6
+#include <log.h>
+
+/* A cached copy of one sector of the file system device. */
+struct cache_entry
+{
+    block_sector_t sector;           /* Sector cached in this slot. */
+    bool valid;                      /* Does this slot hold a sector? */
+    bool dirty;                      /* Modified since read from disk? */
+    bool accessed;                   /* Used since the clock hand last passed? */
+    bool busy;                       /* Being read or written back? */
+    uint8_t data[BLOCK_SECTOR_SIZE]; /* Contents of the sector. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;      /* Protects every slot in CACHE. */
+static struct condition io_done;    /* Signaled when a slot stops being busy. */
+static size_t clock_hand;           /* Next slot the clock algorithm looks at. */
+
+/* Sectors waiting to be read in by the prefetch thread, a ring. */
+static block_sector_t prefetch_queue[PREFETCH_QUEUE_SIZE];
+static size_t prefetch_head;            /* Next sector to read in. */
+static size_t prefetch_cnt;             /* Number of sectors waiting. */
+static struct lock prefetch_lock;       /* Protects the queue. */
+static struct semaphore prefetch_ready; /* Upped once per queued sector. */
+
+static void cache_prefetch_daemon(void *aux);
+
+/* Initializes the buffer cache and starts the prefetch thread.
+ * Dirty sectors are written back when evicted, and periodically by
+ * filesys_sync(). */
+void cache_init(void)
+{
+    size_t i;
+
+    lock_init(&cache_lock);
+    cond_init(&io_done);
+    for (i = 0; i < CACHE_SIZE; i++)
+    {
+        cache[i].valid = false;
+        cache[i].dirty = false;
+        cache[i].accessed = false;
+        cache[i].busy = false;
+    }
+    clock_hand = 0;
+
+    prefetch_head = 0;
+    prefetch_cnt = 0;
+    lock_init(&prefetch_lock);
+    sema_init(&prefetch_ready, 0);
+    thread_create("cache-prefetch", PRI_DEFAULT, cache_prefetch_daemon, NULL);
+}
+
+/* Writes every dirty sector back to disk.  Called when the file
+ * system shuts down. */
+void cache_done(void)
+{
+    cache_flush();
+}
+
+/* Reads or writes ENTRY's sector with the cache lock released, so
+ * other threads can use the rest of the cache meanwhile.  ENTRY is
+ * busy until the transfer is done, which keeps it from being used
+ * or evicted.  The cache lock must be held. */
+static void
+cache_io(struct cache_entry *entry, bool write)
+{
+    ASSERT(lock_held_by_current_thread(&cache_lock));
+    ASSERT(!entry->busy);
+
+    entry->busy = true;
+    lock_release(&cache_lock);
+    if (write)
+        block_write(fs_device, entry->sector, entry->data);
+    else
+        block_read(fs_device, entry->sector, entry->data);
+    lock_acquire(&cache_lock);
+    entry->busy = false;
+    if (write)
+        entry->dirty = false;
+    cond_broadcast(&io_done, &cache_lock);
+}
+
+/* Writes ENTRY back to disk if it is dirty, once any transfer
+ * already under way for it is done.  Sectors changed by the running
+ * journal transaction stay in memory until it commits.
+ * The cache lock must be held. */
+static void
+cache_write_back(struct cache_entry *entry)
+{
+    ASSERT(lock_held_by_current_thread(&cache_lock));
+
+    while (entry->busy)
+    {
+        cond_wait(&io_done, &cache_lock);
+    }
+    if (entry->valid && entry->dirty && !journal_pending(entry->sector))
+    {
+        cache_io(entry, true);
+    }
+}
+
+/* Returns the slot caching SECTOR, or a null pointer if SECTOR is
+ * not in the cache.  The cache lock must be held. */
+static struct cache_entry *
+cache_lookup(block_sector_t sector)
+{
+    size_t i;
+
+    for (i = 0; i < CACHE_SIZE; i++)
+    {
+        if (cache[i].valid && cache[i].sector == sector)
+        {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Chooses a slot to reuse with the clock algorithm and empties it.
+ * Returns a null pointer instead if the cache lock had to be
+ * released on the way, to write the old contents back or to wait
+ * for a busy cache, since the caller must then look again.
+ * The cache lock must be held. */
+static struct cache_entry *
+cache_evict(void)
+{
+    size_t tries;
+
+    /* Two sweeps clear every second chance, so only busy slots are
+     * left after that */
+    for (tries = 0; tries < 2 * CACHE_SIZE; tries++)
+    {
+        struct cache_entry *entry = &cache[clock_hand];
+        clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+        if (entry->busy)
+        {
+            continue;
+        }
+        if (!entry->valid)
+        {
+            return entry;
+        }
+        if (entry->accessed)
+        {
+            /* Second chance. */
+            entry->accessed = false;
+            continue;
+        }
+        log(L_DEBUG, "evicting sector [%d] | dirty [%d]", entry->sector, entry->dirty);
+        if (entry->dirty)
+        {
+            /* Changed by the running transaction, it can't go home
+             * before the commit, so the journal keeps it.  Checked
+             * and saved in one step, so it never gets lost. */
+            if (!journal_save(entry->sector, entry->data))
+            {
+                cache_io(entry, true);
+                entry->valid = false;
+                return NULL;
+            }
+            entry->dirty = false;
+        }
+        entry->valid = false;
+        return entry;
+    }
+    cond_wait(&io_done, &cache_lock);
+    return NULL;
+}
+
+/* Returns the slot holding SECTOR, bringing it into the cache if
+ * necessary.  If READ is false the caller is about to overwrite
+ * the whole sector, so its old contents are not read from disk.
+ * A PREFETCH leaves the slot's accessed bit alone, so only real
+ * uses give it a second chance.
+ * The cache lock must be held.  It is released while waiting for
+ * the disk, so other slots may change in the meantime. */
+static struct cache_entry *
+cache_get(block_sector_t sector, bool read, bool prefetch)
+{
+    struct cache_entry *entry;
+
+    for (;;)
+    {
+        entry = cache_lookup(sector);
+        if (entry != NULL && entry->busy)
+        {
+            /* Somebody else is reading it in or writing it back */
+            cond_wait(&io_done, &cache_lock);
+            continue;
+        }
+        if (entry != NULL)
+        {
+            break;
+        }
+        entry = cache_evict();
+        if (entry == NULL)
+        {
+            continue;
+        }
+        entry->sector = sector;
+        entry->valid = true;
+        entry->dirty = false;
+        entry->accessed = false;
+        if (read && !journal_lookup(sector, entry->data))
+        {
+            cache_io(entry, false);
+        }
+        break;
+    }
+    if (!prefetch)
+    {
+        entry->accessed = true;
+    }
+    return entry;
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+ * BUFFER, going to disk only if SECTOR is not cached. */
+void cache_read_at(block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+    struct cache_entry *entry;
+
+    ASSERT(ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+    lock_acquire(&cache_lock);
+    entry = cache_get(sector, true, false);
+    memcpy(buffer, entry->data + ofs, size);
+    lock_release(&cache_lock);
+}
+
+/* Reads all of SECTOR into BUFFER, which must have room for
+ * BLOCK_SECTOR_SIZE bytes. */
+void cache_read(block_sector_t sector, void *buffer)
+{
+    cache_read_at(sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at byte
+ * OFS.  The data reaches the disk when the sector is evicted or
+ * the cache is flushed. */
+void cache_write_at(block_sector_t sector, const void *buffer, off_t ofs, off_t size)
+{
+    struct cache_entry *entry;
+
+    ASSERT(ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+    lock_acquire(&cache_lock);
+    entry = cache_get(sector, size != BLOCK_SECTOR_SIZE, false);
+    memcpy(entry->data + ofs, buffer, size);
+    entry->dirty = true;
+    lock_release(&cache_lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR. */
+void cache_write(block_sector_t sector, const void *buffer)
+{
+    cache_write_at(sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Copies all of sector FROM over sector TO, slot to slot inside the
+ * cache, so the data is not bounced through a caller's buffer.  TO is
+ * not read from disk since all of it is overwritten. */
+void cache_copy(block_sector_t from, block_sector_t to)
+{
+    struct cache_entry *src, *dst;
+
+    lock_acquire(&cache_lock);
+    /* Bringing TO in may have evicted FROM, in which case go again */
+    do
+    {
+        src = cache_get(from, true, false);
+        dst = cache_get(to, false, false);
+    } while (!src->valid || src->busy || src->sector != from);
+    memcpy(dst->data, src->data, BLOCK_SECTOR_SIZE);
+    dst->dirty = true;
+    lock_release(&cache_lock);
+}
+
+/* Writes all dirty sectors back to disk. */
+void cache_flush(void)
+{
+    size_t i;
+
+    lock_acquire(&cache_lock);
+    for (i = 0; i < CACHE_SIZE; i++)
+    {
+        cache_write_back(&cache[i]);
+    }
+    lock_release(&cache_lock);
+}
+
+/* Writes SECTOR back to disk now if it is cached and dirty, unless
+ * the running journal transaction changed it. */
+void cache_flush_sector(block_sector_t sector)
+{
+    struct cache_entry *entry;
+
+    lock_acquire(&cache_lock);
+    entry = cache_lookup(sector);
+    if (entry != NULL)
+    {
+        cache_write_back(entry);
+    }
+    lock_release(&cache_lock);
+}
+
+/* Asks the prefetch thread to bring SECTOR into the cache.  Does
+ * not wait.  The request is dropped if the queue is full. */
+void cache_prefetch(block_sector_t sector)
+{
+    bool queued = false;
+
+    lock_acquire(&prefetch_lock);
+    if (prefetch_cnt < PREFETCH_QUEUE_SIZE)
+    {
+        prefetch_queue[(prefetch_head + prefetch_cnt) % PREFETCH_QUEUE_SIZE] = sector;
+        prefetch_cnt++;
+        queued = true;
+    }
+    lock_release(&prefetch_lock);
+    if (queued)
+    {
+        sema_up(&prefetch_ready);
+    }
+}
+
+/* Prefetch thread: reads queued sectors into the cache.  They are
+ * left unaccessed, so the clock hand takes them back first if no
+ * read ever uses them.  A read that hits the slot first, even while
+ * it is still coming in, marks it accessed as usual.  The cache lock is not held during the read,
+ * so hits on other sectors go on meanwhile. */
+static void
+cache_prefetch_daemon(void *aux UNUSED)
+{
+    for (;;)
+    {
+        block_sector_t sector;
+
+        sema_down(&prefetch_ready);
+        lock_acquire(&prefetch_lock);
+        sector = prefetch_queue[prefetch_head];
+        prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+        prefetch_cnt--;
+        lock_release(&prefetch_lock);
+
+        lock_acquire(&cache_lock);
+        if (cache_lookup(sector) == NULL)
+        {
+            cache_get(sector, true, true);
+        }
+        lock_release(&cache_lock);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Number of sectors that can wait for prefetch. */
+#define PREFETCH_QUEUE_SIZE 32
+
+void cache_init(void);
+void cache_done(void);
+void cache_read(block_sector_t, void *);
+void cache_read_at(block_sector_t, void *, off_t ofs, off_t size);
+void cache_write(block_sector_t, const void *);
+void cache_write_at(block_sector_t, const void *, off_t ofs, off_t size);
+void cache_copy(block_sector_t from, block_sector_t to);
+void cache_flush(void);
+void cache_flush_sector(block_sector_t);
+void cache_prefetch(block_sector_t);
+
+#endif /* filesys/cache.h */
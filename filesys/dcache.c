@@ -0,0 +1,158 @@
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+
+#include "filesys/dcache.h"
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#define LOGGING_LEVEL 6
+#include <log.h>
+
+/* One cached name lookup: NAME in the directory whose inode is in
+ * sector PARENT resolves to SECTOR, or to DCACHE_NEGATIVE if the
+ * directory has no such name. */
+struct dentry
+{
+    block_sector_t parent;      /* Sector of the directory's inode. */
+    char name[NAME_MAX + 1];    /* Name within the directory. */
+    block_sector_t sector;      /* Inode sector, or DCACHE_NEGATIVE. */
+    struct hash_elem hash_elem; /* Element in DENTRIES. */
+    struct list_elem lru_elem;  /* Element in LRU. */
+};
+
+static struct hash dentries;     /* All cached dentries. */
+static struct list lru;         /* Most recently used at the front. */
+static struct lock dcache_lock; /* Protects DENTRIES and LRU. */
+
+static unsigned
+dentry_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+static bool
+dentry_less(const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+    const struct dentry *a = hash_entry(a_, struct dentry, hash_elem);
+    const struct dentry *b = hash_entry(b_, struct dentry, hash_elem);
+
+    if (a->parent != b->parent)
+    {
+        return a->parent < b->parent;
+    }
+    return strcmp(a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void dcache_init(void)
+{
+    hash_init(&dentries, dentry_hash, dentry_less, NULL);
+    list_init(&lru);
+    lock_init(&dcache_lock);
+}
+
+/* Returns the cached dentry for NAME in PARENT, or a null pointer.
+ * The dcache lock must be held. */
+static struct dentry *
+dentry_find(block_sector_t parent, const char *name)
+{
+    struct dentry key;
+    struct hash_elem *e;
+
+    if (strlen(name) > NAME_MAX)
+    {
+        return NULL;
+    }
+    key.parent = parent;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dentries, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/* Drops D from the cache.  The dcache lock must be held. */
+static void
+dentry_free(struct dentry *d)
+{
+    hash_delete(&dentries, &d->hash_elem);
+    list_remove(&d->lru_elem);
+    free(d);
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+ * Returns false if the name is not cached.  Otherwise stores the
+ * inode sector, or DCACHE_NEGATIVE if the name is known not to
+ * exist, in *SECTOR and returns true. */
+bool dcache_lookup(block_sector_t parent, const char *name, block_sector_t *sector)
+{
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d != NULL)
+    {
+        list_remove(&d->lru_elem);
+        list_push_front(&lru, &d->lru_elem);
+        *sector = d->sector;
+    }
+    lock_release(&dcache_lock);
+    return d != NULL;
+}
+
+/* Remembers that NAME in directory PARENT resolves to SECTOR,
+ * which may be DCACHE_NEGATIVE.  Evicts the least recently used
+ * name if the cache is full. */
+void dcache_insert(block_sector_t parent, const char *name, block_sector_t sector)
+{
+    struct dentry *d;
+
+    if (strlen(name) > NAME_MAX)
+    {
+        return;
+    }
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d == NULL)
+    {
+        if (hash_size(&dentries) >= DCACHE_SIZE)
+        {
+            dentry_free(list_entry(list_back(&lru), struct dentry, lru_elem));
+        }
+        d = malloc(sizeof *d);
+        if (d == NULL)
+        {
+            lock_release(&dcache_lock);
+            return;
+        }
+        d->parent = parent;
+        strlcpy(d->name, name, sizeof d->name);
+        hash_insert(&dentries, &d->hash_elem);
+    }
+    else
+    {
+        list_remove(&d->lru_elem);
+    }
+    list_push_front(&lru, &d->lru_elem);
+    d->sector = sector;
+    log(L_DEBUG, "dcache_insert(parent: [%d], name: [%s], sector: [%d])", parent, name, sector);
+    lock_release(&dcache_lock);
+}
+
+/* Forgets whatever is cached for NAME in directory PARENT.
+ * Must be called whenever the directory entry changes. */
+void dcache_invalidate(block_sector_t parent, const char *name)
+{
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d != NULL)
+    {
+        dentry_free(d);
+    }
+    lock_release(&dcache_lock);
+}
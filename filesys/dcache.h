@@ -0,0 +1,19 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+
+#include "devices/block.h"
+
+/* Maximum number of names the dentry cache remembers. */
+#define DCACHE_SIZE 128
+
+/* Sector stored for a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t)-1)
+
+void dcache_init(void);
+bool dcache_lookup(block_sector_t parent, const char *name, block_sector_t *sector);
+void dcache_insert(block_sector_t parent, const char *name, block_sector_t sector);
+void dcache_invalidate(block_sector_t parent, const char *name);
+
+#endif /* filesys/dcache.h */
@@ -1,7 +1,10 @@
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "filesys/dcache.h"
 #include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -9,11 +12,78 @@
 #define LOGGING_LEVEL 6
 #include <log.h>
 
-/* Creates a directory with space for ENTRY_CNT entries in the
- * given SECTOR.  Returns true if successful, false on failure. */
-bool dir_create(block_sector_t sector, size_t entry_cnt)
+/* Offset of the first entry within a dir_block. */
+#define DIR_BLOCK_ENTRY_OFS offsetof(struct dir_block, entries)
+
+/* Creates a hashed directory in the given SECTOR.  Blocks of
+ * entries are added as names are, so ENTRY_CNT is only a hint.
+ * Returns true if successful, false on failure. */
+bool dir_create(block_sector_t sector, size_t entry_cnt UNUSED)
+{
+    struct dir_header *header;
+    struct inode *inode;
+    bool success = false;
+
+    if (!inode_create(sector, 0, true))
+    {
+        return false;
+    }
+    header = calloc(1, sizeof *header);
+    inode = inode_open(sector);
+    if (header != NULL && inode != NULL)
+    {
+        header->magic = DIR_HASH_MAGIC;
+        header->bucket_cnt = DIR_BUCKET_CNT;
+        success = inode_write_at(inode, header, sizeof *header, 0) == sizeof *header;
+    }
+    inode_close(inode);
+    free(header);
+    return success;
+}
+
+/* Returns true if the directory in INODE uses the hashed format,
+ * false if it is a linear array of entries. */
+static bool
+dir_is_hashed(struct inode *inode)
+{
+    unsigned magic;
+
+    return inode_read_at(inode, &magic, sizeof magic, 0) == sizeof magic && magic == DIR_HASH_MAGIC;
+}
+
+/* Returns the bucket NAME hashes to. */
+static uint32_t
+dir_bucket(const char *name)
 {
-    return inode_create(sector, entry_cnt * sizeof(struct dir_entry), true);
+    return hash_string(name) % DIR_BUCKET_CNT;
+}
+
+/* Returns the offset of the first entry slot at or after OFS.
+ * For hashed directories this skips the header and the start of
+ * each block, for linear ones every offset is a slot. */
+static off_t
+entry_ofs(bool hashed, off_t ofs)
+{
+    off_t in_block;
+
+    if (!hashed)
+    {
+        return ofs;
+    }
+    if (ofs < BLOCK_SECTOR_SIZE)
+    {
+        ofs = BLOCK_SECTOR_SIZE;
+    }
+    in_block = ofs % BLOCK_SECTOR_SIZE;
+    if (in_block < (off_t)DIR_BLOCK_ENTRY_OFS)
+    {
+        ofs += DIR_BLOCK_ENTRY_OFS - in_block;
+    }
+    else if (in_block + sizeof(struct dir_entry) > DIR_BLOCK_ENTRY_OFS + DIR_BLOCK_ENTRIES * sizeof(struct dir_entry))
+    {
+        ofs = ROUND_UP(ofs, BLOCK_SECTOR_SIZE) + DIR_BLOCK_ENTRY_OFS;
+    }
+    return ofs;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -70,14 +140,154 @@ dir_get_inode(struct dir *dir)
     return dir->inode;
 }
 
+/* Searches the bucket chain of hashed directory DIR for NAME.
+ * Works like lookup(), and in addition, if FREEP is non-null, sets
+ * *FREEP to the offset of the first free slot in the chain, or to
+ * the offset of the chain's last block, negated, if it has no free
+ * slot, or to 0 if the bucket is still empty. */
+static bool
+lookup_hashed(const struct dir *dir, const char *name,
+              struct dir_entry *ep, off_t *ofsp, off_t *freep,
+              bool *failedp)
+{
+    struct dir_header header;
+    struct dir_block *block;
+    uint32_t bucket = dir_bucket(name);
+    uint32_t blk;
+    bool found = false;
+    size_t i;
+
+    if (freep != NULL)
+    {
+        *freep = 0;
+    }
+    if (failedp != NULL)
+    {
+        *failedp = true;
+    }
+    if (inode_read_at(dir->inode, &header, sizeof header, 0) != sizeof header)
+    {
+        return false;
+    }
+    block = malloc(sizeof *block);
+    if (block == NULL)
+    {
+        return false;
+    }
+
+    for (blk = header.buckets[bucket]; blk != 0 && !found; blk = block->next)
+    {
+        off_t block_ofs = (off_t)blk * BLOCK_SECTOR_SIZE;
+        if (inode_read_at(dir->inode, block, sizeof *block, block_ofs) != sizeof *block)
+        {
+            free(block);
+            return false;
+        }
+        if (freep != NULL && *freep <= 0)
+        {
+            *freep = -block_ofs;
+        }
+        for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+        {
+            struct dir_entry *e = &block->entries[i];
+            off_t ofs = block_ofs + DIR_BLOCK_ENTRY_OFS + i * sizeof *e;
+            if (!e->in_use)
+            {
+                if (freep != NULL && *freep <= 0)
+                {
+                    *freep = ofs;
+                }
+            }
+            else if (!strcmp(name, e->name))
+            {
+                if (ep != NULL)
+                {
+                    *ep = *e;
+                }
+                if (ofsp != NULL)
+                {
+                    *ofsp = ofs;
+                }
+                found = true;
+                break;
+            }
+        }
+    }
+    free(block);
+    if (failedp != NULL)
+    {
+        *failedp = false;
+    }
+    return found;
+}
+
+/* Adds entry E to hashed directory DIR.  FREE_OFS is what
+ * lookup_hashed() stored for E's name: a free slot to reuse, or
+ * the block to chain a new block after, or 0 for an empty bucket.
+ * IS_DIR goes into the block's dir_mask.  New blocks always go at
+ * the end of the directory, so existing entries never move. */
+static bool
+add_hashed(struct dir *dir, const struct dir_entry *e, off_t free_ofs, bool is_dir)
+{
+    struct dir_block *block;
+    uint32_t bucket = dir_bucket(e->name);
+    uint32_t blk;
+    bool success = false;
+
+    if (free_ofs > 0)
+    {
+        off_t mask_ofs = ROUND_DOWN(free_ofs, BLOCK_SECTOR_SIZE) + offsetof(struct dir_block, dir_mask);
+        uint32_t bit = 1u << (free_ofs % BLOCK_SECTOR_SIZE - DIR_BLOCK_ENTRY_OFS) / sizeof *e;
+        uint32_t mask;
+
+        /* The type first, the entry is not in use until it is written */
+        if (inode_read_at(dir->inode, &mask, sizeof mask, mask_ofs) != sizeof mask)
+        {
+            return false;
+        }
+        mask = is_dir ? mask | bit : mask & ~bit;
+        return inode_write_at(dir->inode, &mask, sizeof mask, mask_ofs) == sizeof mask && inode_write_at(dir->inode, e, sizeof *e, free_ofs) == sizeof *e;
+    }
+
+    block = calloc(1, sizeof *block);
+    if (block == NULL)
+    {
+        return false;
+    }
+    blk = inode_length(dir->inode) / BLOCK_SECTOR_SIZE;
+    block->next = 0;
+    block->bucket = bucket;
+    block->entries[0] = *e;
+    block->dir_mask = is_dir ? 1 : 0;
+    if (inode_write_at(dir->inode, block, sizeof *block, (off_t)blk * BLOCK_SECTOR_SIZE) == sizeof *block)
+    {
+        /* Link the new block in only once it is written. */
+        if (free_ofs == 0)
+        {
+            success = inode_write_at(dir->inode, &blk, sizeof blk,
+                                     offsetof(struct dir_header, buckets) + bucket * sizeof blk) == sizeof blk;
+        }
+        else
+        {
+            success = inode_write_at(dir->inode, &blk, sizeof blk,
+                                     -free_ofs + offsetof(struct dir_block, next)) == sizeof blk;
+        }
+    }
+    free(block);
+    return success;
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
  * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+ * otherwise, returns false and ignores EP and OFSP.
+ * If FAILEDP is non-null, sets *FAILEDP to true if the search
+ * could not be finished for lack of memory or a short read, so
+ * NAME may exist after all, and to false otherwise. */
 static bool
 lookup(const struct dir *dir, const char *name,
-       struct dir_entry *ep, off_t *ofsp)
+       struct dir_entry *ep, off_t *ofsp, bool *failedp)
 {
     struct dir_entry e;
     size_t ofs;
@@ -85,6 +295,17 @@ lookup(const struct dir *dir, const char *name,
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    if (dir_is_hashed(dir->inode))
+    {
+        return lookup_hashed(dir, name, ep, ofsp, NULL, failedp);
+    }
+
+    /* A short read only happens at the end of the directory */
+    if (failedp != NULL)
+    {
+        *failedp = false;
+    }
+
     for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
          ofs += sizeof e)
     {
@@ -107,23 +328,41 @@ lookup(const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
- * a null pointer.  The caller must close *INODE. */
+ * a null pointer.  The caller must close *INODE.
+ * Checks the dentry cache first and records the result there. */
 bool dir_lookup(const struct dir *dir, const char *name,
                 struct inode **inode)
 {
     struct dir_entry e;
+    block_sector_t parent;
+    block_sector_t sector;
+    bool failed;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    if (lookup(dir, name, &e, NULL))
+    /* Shared, so the entry can't be removed before its inode is open */
+    parent = inode_get_inumber(dir->inode);
+    rwlock_acquire_read(&dir->inode->dir_lock);
+    if (!dcache_lookup(parent, name, &sector))
     {
-        *inode = inode_open(e.inode_sector);
+        sector = lookup(dir, name, &e, NULL, &failed) ? e.inode_sector : DCACHE_NEGATIVE;
+        /* A search that gave up proves nothing about NAME */
+        if (!failed)
+        {
+            dcache_insert(parent, name, sector);
+        }
+    }
+
+    if (sector != DCACHE_NEGATIVE)
+    {
+        *inode = inode_open(sector);
     }
     else
     {
         *inode = NULL;
     }
+    rwlock_release_read(&dir->inode->dir_lock);
 
     return *inode != NULL;
 }
@@ -134,13 +373,15 @@ bool dir_lookup(const struct dir *dir, const char *name,
  * Returns true if successful, false on failure.
  * Fails if NAME is invalid (i.e. too long) or a disk or memory
  * error occurs. */
-bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
+bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 {
     log(L_TRACE, "dir_add(dir: [%08x], name: [%s], inode_sector [%d] )", dir->inode, name, inode_sector);
     // log(L_DEBUG, "Here");
     struct dir_entry e;
     off_t ofs;
     bool success = false;
+    bool hashed;
+    bool failed;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
@@ -151,12 +392,28 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
         return false;
     }
 
-    /* Check that NAME is not in use. */
-    if (lookup(dir, name, NULL, NULL))
+    rwlock_acquire_write(&dir->inode->dir_lock);
+
+    /* No new entries in a directory that is being deleted */
+    if (dir->inode->removed)
+    {
+        log(L_ERROR, "Directory was removed, cannot add [%s]", name);
+        goto done;
+    }
+
+    /* Check that NAME is not in use.  For a hashed directory this
+     * also finds where the new entry goes. */
+    hashed = dir_is_hashed(dir->inode);
+    if (hashed ? lookup_hashed(dir, name, NULL, NULL, &ofs, &failed) : lookup(dir, name, NULL, NULL, &failed))
     {
         log(L_ERROR, "name: [%s] is taken", name);
         goto done;
     }
+    if (failed)
+    {
+        log(L_ERROR, "could not search for [%s]", name);
+        goto done;
+    }
 
     /* Sets the directory as the parent_sector of the inode being added to this directory */
     if (!set_inode_parent(inode_get_inumber(dir_get_inode(dir)), inode_sector))
@@ -172,33 +429,43 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
      * Otherwise, we'd need to verify that we didn't get a short
      * read due to something intermittent such as low memory. */
     // log(L_DEBUG, "Here 2");
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-         ofs += sizeof e)
+    if (!hashed)
     {
-        if (!e.in_use)
+        for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+             ofs += sizeof e)
         {
-            break;
+            if (!e.in_use)
+            {
+                break;
+            }
         }
     }
 
     /* Write slot. */
+    memset(&e, 0, sizeof e);
     e.in_use = true;
     strlcpy(e.name, name, sizeof e.name);
     e.inode_sector = inode_sector;
-    success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+    if (hashed)
+        success = add_hashed(dir, &e, ofs, is_dir);
+    else
+        success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+    dcache_invalidate(inode_get_inumber(dir->inode), name);
 
 done:
+    rwlock_release_write(&dir->inode->dir_lock);
     log(L_DEBUG, "dir_add success : [%d]", success);
     return success;
 }
 bool dir_is_empty(struct inode *inode)
 {
     struct dir_entry e;
-    off_t pos = 0;
+    bool hashed = dir_is_hashed(inode);
+    off_t pos = entry_ofs(hashed, 0);
 
     while (inode_read_at(inode, &e, sizeof e, pos) == sizeof e)
     {
-        pos += sizeof e;
+        pos = entry_ofs(hashed, pos + sizeof e);
         if (e.in_use)
         {
             return false;
@@ -214,13 +481,16 @@ bool dir_remove(struct dir *dir, const char *name)
     struct dir_entry e;
     struct inode *inode = NULL;
     bool success = false;
+    bool locked = false;
     off_t ofs;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    rwlock_acquire_write(&dir->inode->dir_lock);
+
     /* Find directory entry. */
-    if (!lookup(dir, name, &e, &ofs))
+    if (!lookup(dir, name, &e, &ofs, NULL))
     {
         goto done;
     }
@@ -231,12 +501,20 @@ bool dir_remove(struct dir *dir, const char *name)
     {
         goto done;
     }
-    /* Is dir empty? */
-    if (inode->data.isDir && !dir_is_empty(inode))
-        goto done;
+    /* Is dir empty?  Its lock is held until it is marked removed, so
+     * nothing can be added to it in between.  Parents are always
+     * locked before children. */
+    if (inode->data.isDir)
+    {
+        rwlock_acquire_write(&inode->dir_lock);
+        locked = true;
+        if (!dir_is_empty(inode))
+            goto done;
+    }
 
     /* Erase directory entry. */
     e.in_use = false;
+    dcache_invalidate(inode_get_inumber(dir->inode), name);
     if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
     {
         goto done;
@@ -247,27 +525,102 @@ bool dir_remove(struct dir *dir, const char *name)
     success = true;
 
 done:
+    if (locked)
+        rwlock_release_write(&inode->dir_lock);
+    rwlock_release_write(&dir->inode->dir_lock);
     inode_close(inode);
     return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
  * NAME.  Returns true if successful, false if the directory
- * contains no more entries. */
+ * contains no more entries.
+ * Entries come back in the order they sit in the directory file,
+ * which does not change as other entries are added or removed. */
 bool dir_readdir(struct dir *dir, char name[NAME_MAX + 1])
 {
     struct dir_entry e;
+    bool hashed = dir_is_hashed(dir->inode);
+    bool found = false;
 
-    while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+    rwlock_acquire_read(&dir->inode->dir_lock);
+    dir->pos = entry_ofs(hashed, dir->pos);
+    while (!found && inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
     {
-        dir->pos += sizeof e;
+        dir->pos = entry_ofs(hashed, dir->pos + sizeof e);
         if (e.in_use)
         {
             strlcpy(name, e.name, NAME_MAX + 1);
-            return true;
+            found = true;
         }
     }
-    return false;
+    rwlock_release_read(&dir->inode->dir_lock);
+    return found;
+}
+
+/* Reads up to MAX entries of DIR, starting at its current
+ * position, into ENTS.  Returns the number read, 0 at the end.
+ * Works a directory sector at a time instead of one inode_read_at()
+ * per entry, for listing big directories.  Hashed directories keep
+ * each entry's type in its block, old linear ones don't, so their
+ * entries are opened to find it, once the directory is unlocked. */
+int dir_readdir_bulk(struct dir *dir, struct dirent *ents, int max)
+{
+    /* A whole sector, plus room for a linear entry that runs past it */
+    const off_t window = BLOCK_SECTOR_SIZE + sizeof(struct dir_entry);
+    bool hashed = dir_is_hashed(dir->inode);
+    struct dir_entry e;
+    uint8_t *buf;
+    int cnt = 0;
+    int i;
+
+    buf = malloc(window);
+    if (buf == NULL)
+    {
+        return 0;
+    }
+
+    rwlock_acquire_read(&dir->inode->dir_lock);
+    dir->pos = entry_ofs(hashed, dir->pos);
+    while (cnt < max)
+    {
+        off_t base = ROUND_DOWN(dir->pos, BLOCK_SECTOR_SIZE);
+        off_t got = inode_read_at(dir->inode, buf, window, base);
+        if (dir->pos + (off_t)sizeof e > base + got)
+        {
+            /* End of directory */
+            break;
+        }
+
+        /* Every entry that starts in this sector */
+        while (cnt < max && dir->pos < base + BLOCK_SECTOR_SIZE && dir->pos + (off_t)sizeof e <= base + got)
+        {
+            off_t slot = (dir->pos - base - DIR_BLOCK_ENTRY_OFS) / sizeof e;
+
+            memcpy(&e, buf + (dir->pos - base), sizeof e);
+            dir->pos = entry_ofs(hashed, dir->pos + sizeof e);
+            if (e.in_use)
+            {
+                ents[cnt].d_ino = e.inode_sector;
+                ents[cnt].d_isdir = hashed && (((struct dir_block *)buf)->dir_mask & (1u << slot)) != 0;
+                strlcpy(ents[cnt].d_name, e.name, sizeof ents[cnt].d_name);
+                cnt++;
+            }
+        }
+    }
+    rwlock_release_read(&dir->inode->dir_lock);
+
+    /* Closing an inode may start a journal operation, which must not
+     * happen under the directory lock */
+    for (i = 0; !hashed && i < cnt; i++)
+    {
+        struct inode *inode = inode_open(ents[i].d_ino);
+        ents[i].d_isdir = inode != NULL && inode->data.isDir;
+        inode_close(inode);
+    }
+
+    free(buf);
+    return cnt;
 }
 
 /*
@@ -1,6 +1,7 @@
 #ifndef FILESYS_DIRECTORY_H
 #define FILESYS_DIRECTORY_H
 
+#include <dirent.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -44,6 +45,43 @@ struct dir_entry
     bool in_use;                 /* In use or free? */
 };
 
+/*
+        HASHED DIRECTORIES
+
+ * The first sector of a hashed directory is a dir_header, every sector
+ * after it is a dir_block holding entries that hash to one bucket.
+ * Directories without DIR_HASH_MAGIC at offset 0 are the old linear
+ * array of dir_entry, and are still read and written that way.
+ *
+ *           +---------------++---------------+---------------+
+ *           |     HEADER    ||    BLOCK 1    |    BLOCK 2    |
+ *           +---------------++---------------+---------------+
+ *           | bucket 7 -> 1 || next: 0       | next: 0       |
+ *           | bucket 9 -> 2 || 25 entries    | 25 entries    |
+ *           +---------------++---------------+---------------+
+ *
+*/
+#define DIR_HASH_MAGIC 0x44495248 /* "DIRH" */
+#define DIR_BUCKET_CNT 126
+#define DIR_BLOCK_ENTRIES 25
+
+/* First sector of a hashed directory */
+struct dir_header
+{
+    unsigned magic;                   /* DIR_HASH_MAGIC. */
+    uint32_t bucket_cnt;              /* DIR_BUCKET_CNT. */
+    uint32_t buckets[DIR_BUCKET_CNT]; /* First block of each bucket's chain, 0 if empty. */
+};
+
+/* A sector of entries in a hashed directory */
+struct dir_block
+{
+    uint32_t next;                               /* Next block in this bucket's chain, 0 if last. */
+    uint32_t bucket;                             /* Bucket this block belongs to. */
+    struct dir_entry entries[DIR_BLOCK_ENTRIES]; /* Entries. */
+    uint32_t dir_mask;                           /* Bit I set if entries[I] is a directory. */
+};
+
 /* Opening and closing directories. */
 bool dir_create(block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open(struct inode *);
@@ -54,9 +92,10 @@ struct inode *dir_get_inode(struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup(const struct dir *, const char *name, struct inode **);
-bool dir_add(struct dir *, const char *name, block_sector_t);
+bool dir_add(struct dir *, const char *name, block_sector_t, bool is_dir);
 bool dir_remove(struct dir *, const char *name);
 bool dir_readdir(struct dir *, char name[NAME_MAX + 1]);
+int dir_readdir_bulk(struct dir *, struct dirent *, int max);
 
 /* NEW FUNCTIONS*/
 bool is_root_dir(struct dir *dir);
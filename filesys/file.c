@@ -4,6 +4,12 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window limits, in sectors. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 16
+
+static void file_readahead(struct file *, off_t ofs, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
@@ -17,6 +23,9 @@ file_open(struct inode *inode)
         file->inode = inode;
         file->pos = 0;
         file->deny_write = false;
+        file->ra_next = 0;
+        file->ra_queued = 0;
+        file->ra_window = 0;
         return file;
     }
     else
@@ -62,6 +71,7 @@ off_t file_read(struct file *file, void *buffer, off_t size)
 {
     off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
 
+    file_readahead(file, file->pos, bytes_read);
     file->pos += bytes_read;
     return bytes_read;
 }
@@ -73,7 +83,53 @@ off_t file_read(struct file *file, void *buffer, off_t size)
  * The file's current position is unaffected. */
 off_t file_read_at(struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-    return inode_read_at(file->inode, buffer, size, file_ofs);
+    off_t bytes_read = inode_read_at(file->inode, buffer, size, file_ofs);
+
+    file_readahead(file, file_ofs, bytes_read);
+    return bytes_read;
+}
+
+/* Called after FILE read SIZE bytes at OFS.  A read that starts
+ * where the last one ended doubles the read-ahead window, any other
+ * read halves it.  While the window is open, queues prefetch of the
+ * sectors up to a window past the end of this read, so the next
+ * reads find them in the buffer cache. */
+static void
+file_readahead(struct file *file, off_t ofs, off_t size)
+{
+    off_t start, end;
+
+    if (size <= 0)
+    {
+        return;
+    }
+
+    if (ofs == file->ra_next)
+    {
+        file->ra_window = file->ra_window == 0 ? READAHEAD_MIN : file->ra_window * 2;
+        if (file->ra_window > READAHEAD_MAX)
+        {
+            file->ra_window = READAHEAD_MAX;
+        }
+    }
+    else
+    {
+        file->ra_window /= 2;
+        file->ra_queued = 0;
+    }
+    file->ra_next = ofs + size;
+    if (file->ra_window == 0)
+    {
+        return;
+    }
+
+    start = file->ra_next > file->ra_queued ? file->ra_next : file->ra_queued;
+    end = file->ra_next + (off_t)file->ra_window * BLOCK_SECTOR_SIZE;
+    if (start < end)
+    {
+        inode_readahead(file->inode, start, end);
+        file->ra_queued = end;
+    }
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -104,6 +160,18 @@ off_t file_write_at(struct file *file, const void *buffer, off_t size,
     return inode_write_at(file->inode, buffer, size, file_ofs);
 }
 
+/* Copies SIZE bytes of SRC starting at SRC_OFS into DST starting at
+ * DST_OFS, without going through user memory.
+ * Returns the number of bytes actually copied, which may be less
+ * than SIZE if end of SRC is reached or DST can't grow, and 0 if
+ * the copy would move bytes within one file to a later offset they
+ * overlap.  Neither file's current position is affected. */
+off_t file_copy_range(struct file *src, off_t src_ofs, struct file *dst,
+                      off_t dst_ofs, off_t size)
+{
+    return inode_copy_range(src->inode, src_ofs, dst->inode, dst_ofs, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void file_deny_write(struct file *file)
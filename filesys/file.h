@@ -10,6 +10,12 @@ struct file
     struct inode *inode; /* File's inode. */
     off_t pos;           /* Current position. */
     bool deny_write;     /* Has file_deny_write() been called? */
+
+    /* Read-ahead.  Kept after the fields above, directories are
+     * read through a `struct file' cast to `struct dir'. */
+    off_t ra_next;    /* Where the next sequential read starts. */
+    off_t ra_queued;  /* End of what was already queued for prefetch. */
+    size_t ra_window; /* Sectors to read ahead, 0 while reads look random. */
 };
 
 /* Opening and closing files. */
@@ -23,6 +29,8 @@ off_t file_read(struct file *, void *, off_t);
 off_t file_read_at(struct file *, void *, off_t size, off_t start);
 off_t file_write(struct file *, const void *, off_t);
 off_t file_write_at(struct file *, const void *, off_t size, off_t start);
+off_t file_copy_range(struct file *src, off_t src_ofs, struct file *dst,
+                      off_t dst_ofs, off_t size);
 
 /* Preventing writes. */
 void file_deny_write(struct file *);
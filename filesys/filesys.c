@@ -2,10 +2,14 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "filesys/inode.h"
 
 #include "threads/thread.h"
@@ -15,7 +19,12 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* How often, in timer ticks, the write-behind thread syncs the
+ * file system. */
+#define FILESYS_SYNC_TICKS TIMER_FREQ
+
 static void do_format(void);
+static void filesys_sync_daemon(void *aux);
 
 /*
 Given a pathname, opens the directory to that name.
@@ -107,7 +116,10 @@ void filesys_init(bool format)
         PANIC("No file system device found, can't initialize file system.");
     }
 
+    cache_init();
+    journal_init(format);
     inode_init();
+    dcache_init();
     free_map_init();
 
     if (format)
@@ -116,13 +128,47 @@ void filesys_init(bool format)
     }
 
     free_map_open();
+    thread_create("fs-sync", PRI_DEFAULT, filesys_sync_daemon, NULL);
 }
 
 /* Shuts down the file system module, writing any unwritten data
  * to disk. */
 void filesys_done(void)
 {
+    /* The second sync writes out the free map bits of the sectors
+     * the first one made reusable. */
+    filesys_sync();
+    filesys_sync();
     free_map_close();
+    /* Closing joined the last free map bits to a transaction */
+    journal_commit();
+    cache_done();
+}
+
+/* Writes everything the file system has in memory to disk.
+ * With a journal, the commit takes the free map and all metadata
+ * changed since the last sync to disk at once.  Without one, the
+ * commit still writes the free map to disk first, ahead of the
+ * inodes in the cache flush.  Released sectors become
+ * reusable only after that, and their bits reach the disk with
+ * the next sync.  Must not be called inside a journal operation. */
+void filesys_sync(void)
+{
+    journal_commit();
+    cache_flush();
+    free_map_commit_releases();
+}
+
+/* Write-behind thread: periodically syncs the file system so that
+ * dirty sectors do not linger in memory indefinitely. */
+static void
+filesys_sync_daemon(void *aux UNUSED)
+{
+    for (;;)
+    {
+        timer_sleep(FILESYS_SYNC_TICKS);
+        filesys_sync();
+    }
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -137,20 +183,16 @@ bool filesys_create(const char *name, off_t initial_size, bool is_dir)
     char *filename = get_filename(name);
     struct dir *dir = parse_path_dir(name);
 
-    /* If the directory is in use maybe*/
-    if (dir->inode->removed)
-    {
-        log(L_ERROR, "Directory was remove, cannot create the file");
-        return false;
-    }
-
-    log(L_DEBUG, "name: [%s] | filename: [%s] | dir: [%08x] ", name, filename, dir->inode);
-    bool success = (dir != NULL && free_map_allocate(1, &inode_sector) && inode_create(inode_sector, initial_size, is_dir) && dir_add(dir, filename, inode_sector));
+    /* dir_add() refuses a directory that was removed */
+    log(L_DEBUG, "name: [%s] | filename: [%s] | dir: [%08x] ", name, filename, dir);
+    journal_begin();
+    bool success = (dir != NULL && free_map_allocate(1, &inode_sector) && (is_dir ? dir_create(inode_sector, 0) : inode_create(inode_sector, initial_size, false)) && dir_add(dir, filename, inode_sector, is_dir));
 
     if (!success && inode_sector != 0)
     {
         free_map_release(inode_sector, 1);
     }
+    journal_end();
     // if (is_dir)
     // {
     /* Trying to add the "." and ".." to the directory, not sure if totally needed*/
@@ -202,13 +244,38 @@ bool filesys_remove(const char *name)
 {
     char *filename = get_filename(name);
     struct dir *dir = parse_path_dir(name);
+    journal_begin();
     bool success = dir != NULL && dir_remove(dir, filename);
 
     dir_close(dir);
+    journal_end();
     free(filename);
     return success;
 }
 
+/* Fills *ST with the size, type and inode number of the file named
+ * NAME, looking it up once without opening a file for it.
+ * Returns false if no file named NAME exists. */
+bool filesys_stat(const char *name, struct stat *st)
+{
+    log(L_TRACE, "filesys_stat(name: [%s])", name);
+    char *filename = get_filename(name);
+    struct dir *dir = parse_path_dir(name);
+    struct inode *inode = NULL;
+
+    if (dir != NULL && strcmp(filename, ""))
+        dir_lookup(dir, filename, &inode);
+    else if (dir != NULL)
+        inode = inode_reopen(dir_get_inode(dir)); /* The directory itself */
+
+    if (inode != NULL)
+        inode_stat(inode, st);
+    inode_close(inode);
+    dir_close(dir);
+    free(filename);
+    return inode != NULL;
+}
+
 /*
 * Given a file_name/path change the directory
  WORK IN PROGRESS
@@ -276,10 +343,12 @@ do_format(void)
 {
     printf("Formatting file system...");
     free_map_create();
+    journal_create();
     if (!dir_create(ROOT_DIR_SECTOR, 16))
     {
         PANIC("root directory creation failed");
     }
     free_map_close();
+    journal_commit();
     printf("done.\n");
 }
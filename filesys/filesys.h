@@ -5,18 +5,23 @@
 
 #include "filesys/off_t.h"
 
+struct stat;
+
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0 /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1 /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2  /* Journal header sector. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init(bool format);
 void filesys_done(void);
+void filesys_sync(void);
 bool filesys_create(const char *name, off_t initial_size, bool is_dir);
 struct file *filesys_open(const char *name);
 bool filesys_remove(const char *name);
 bool filesys_chdir(const char *name);
+bool filesys_stat(const char *name, struct stat *);
 
 #endif /* filesys/filesys.h */
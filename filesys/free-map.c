@@ -1,16 +1,47 @@
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 #define LOGGING_LEVEL 6
 #include <log.h>
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per sector. */
 
+/* Changes to the free map are not written out right away.
+ * DIRTY_MAP has one bit per sector of the free map file, set when
+ * that part of the bitmap changed since the last flush, so a flush
+ * only rewrites the sectors that changed.
+ *
+ * Released sectors are only recorded in RELEASE_MAP.  They stay
+ * allocated in FREE_MAP until free_map_commit_releases() runs after
+ * the inode changes that dropped them have reached the disk, so a
+ * crash can never leave an on-disk inode pointing at a sector that
+ * was handed out again. */
+static struct bitmap *dirty_map;   /* Dirty free map file sectors. */
+static struct bitmap *release_map; /* Released, not yet reusable sectors. */
+static size_t release_cnt;         /* Number of bits set in RELEASE_MAP. */
+static struct lock free_map_lock;  /* Protects all of the above. */
+static size_t cursor;              /* Where scans without a goal start. */
+
+/* Marks the free map file sectors holding the bits for CNT
+ * sectors starting at SECTOR as dirty. */
+static void
+mark_dirty(block_sector_t sector, size_t cnt)
+{
+    size_t first = sector / 8 / BLOCK_SECTOR_SIZE;
+    size_t last = (sector + cnt - 1) / 8 / BLOCK_SECTOR_SIZE;
+
+    bitmap_set_multiple(dirty_map, first, last - first + 1, true);
+}
+
 /* Initializes the free map. */
 void free_map_init(void)
 {
@@ -19,45 +50,241 @@ void free_map_init(void)
     {
         PANIC("bitmap creation failed--file system device is too large");
     }
+    dirty_map = bitmap_create(DIV_ROUND_UP(bitmap_file_size(free_map), BLOCK_SECTOR_SIZE));
+    release_map = bitmap_create(block_size(fs_device));
+    if (dirty_map == NULL || release_map == NULL)
+    {
+        PANIC("bitmap creation failed--file system device is too large");
+    }
+    release_cnt = 0;
+    cursor = 0;
+    lock_init(&free_map_lock);
     bitmap_mark(free_map, FREE_MAP_SECTOR);
     bitmap_mark(free_map, ROOT_DIR_SECTOR);
+    bitmap_mark(free_map, JOURNAL_SECTOR);
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
- * Returns true if successful, false if not enough consecutive
- * sectors were available or if the free_map file could not be
- * written.
- */
-/*
-& NEEDS TO CHANGE allocate one sector at a time
-? Don't need the cnt, but for now keeping it to not change the call
-*/
-bool free_map_allocate(size_t cnt, block_sector_t *sectorp)
+/* Returns the number of sectors in the free map file. */
+size_t free_map_sector_cnt(void)
 {
-    // block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-    block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
+    return bitmap_size(dirty_map);
+}
 
-    if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file))
+/* Finds the free run nearest to GOAL, scanning forward from GOAL
+ * and wrapping around to sector 0.  Stops at the first run of at
+ * least CNT sectors, otherwise settles for the longest one seen.
+ * Stores its start in *STARTP and returns its length, capped at
+ * CNT, or 0 if the disk is full.  The free map lock must be held. */
+static size_t
+find_run(size_t goal, size_t cnt, block_sector_t *startp)
+{
+    size_t size = bitmap_size(free_map);
+    size_t origin = goal < size ? goal : 0;
+    size_t pos = origin;
+    size_t best = 0;
+    bool wrapped = false;
+
+    for (;;)
     {
-        /* DO not want to set multiple */
-        bitmap_set_multiple(free_map, sector, cnt, false);
-        sector = BITMAP_ERROR;
+        size_t start = pos < size ? bitmap_scan(free_map, pos, 1, false) : BITMAP_ERROR;
+        size_t end;
+
+        if (wrapped && start != BITMAP_ERROR && start >= origin)
+        {
+            start = BITMAP_ERROR;
+        }
+        if (start == BITMAP_ERROR)
+        {
+            if (wrapped || origin == 0)
+            {
+                break;
+            }
+            wrapped = true;
+            pos = 0;
+            continue;
+        }
+        end = bitmap_scan(free_map, start, 1, true);
+        if (end == BITMAP_ERROR)
+        {
+            end = size;
+        }
+        if (end - start > best)
+        {
+            best = end - start;
+            *startp = start;
+            if (best >= cnt)
+            {
+                return cnt;
+            }
+        }
+        pos = end;
     }
-    if (sector != BITMAP_ERROR)
+    return best;
+}
+
+/* Allocates up to CNT consecutive sectors as near to GOAL as it
+ * can, or exactly CNT if EXACT.  A GOAL of 0 means no preference,
+ * the scan then picks up where the last allocation ended.  If
+ * nothing fits but there are released sectors waiting, syncs the
+ * file system so they can be reused and tries once more.
+ * The bitmap is only changed in memory, it reaches the disk at the
+ * next free_map_flush(). */
+static bool
+allocate(block_sector_t goal, size_t cnt, bool exact,
+         block_sector_t *startp, size_t *gotp)
+{
+    block_sector_t start = 0;
+    size_t got = 0;
+    int tries;
+
+    ASSERT(cnt > 0);
+
+    for (tries = 0; tries < 2; tries++)
     {
-        *sectorp = sector;
+        bool retry;
+
+        lock_acquire(&free_map_lock);
+        got = find_run(goal != 0 ? goal : cursor, cnt, &start);
+        if (exact && got < cnt)
+        {
+            got = 0;
+        }
+        if (got > 0)
+        {
+            bitmap_set_multiple(free_map, start, got, true);
+            mark_dirty(start, got);
+            cursor = start + got;
+        }
+        /* Can't sync from inside a journal operation, the commit
+         * would wait for it to end. */
+        retry = got == 0 && release_cnt > 0 && !journal_active();
+        lock_release(&free_map_lock);
+
+        if (!retry)
+        {
+            break;
+        }
+        log(L_INFO, "free map full, syncing to reuse released sectors");
+        filesys_sync();
+    }
+
+    if (got == 0)
+    {
+        return false;
     }
-    log(L_DEBUG, "free_map_allocated sector #: [%d] | sectorp [%d]", sector, *sectorp);
-    return sector != BITMAP_ERROR;
+    *startp = start;
+    *gotp = got;
+    return true;
+}
+
+/* Allocates CNT consecutive sectors from the free map and stores
+ * the first into *SECTORP.
+ * Returns true if successful, false if not enough consecutive
+ * sectors were available. */
+bool free_map_allocate(size_t cnt, block_sector_t *sectorp)
+{
+    size_t got;
+    bool success = allocate(0, cnt, true, sectorp, &got);
+
+    log(L_DEBUG, "free_map_allocate cnt: [%d] | success: [%d] | sector: [%d]", cnt, success, success ? *sectorp : 0);
+    return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates between 1 and CNT consecutive sectors, preferring the
+ * free run closest at or after GOAL, such as the sector after a
+ * file's last block.  Stores the first sector into *SECTORP and
+ * the number allocated into *GOTP.
+ * Returns false only if the disk is full. */
+bool free_map_allocate_near(block_sector_t goal, size_t cnt,
+                            block_sector_t *sectorp, size_t *gotp)
+{
+    bool success = allocate(goal, cnt, false, sectorp, gotp);
+
+    log(L_DEBUG, "free_map_allocate_near goal: [%d] | cnt: [%d] | success: [%d] | sector: [%d] | got: [%d]",
+        goal, cnt, success, success ? *sectorp : 0, success ? *gotp : 0);
+    return success;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+ * free_map_commit_releases() has been called. */
 void free_map_release(block_sector_t sector, size_t cnt)
 {
+    lock_acquire(&free_map_lock);
     ASSERT(bitmap_all(free_map, sector, cnt));
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    bitmap_write(free_map, free_map_file);
+    ASSERT(bitmap_none(release_map, sector, cnt));
+    bitmap_set_multiple(release_map, sector, cnt, true);
+    release_cnt += cnt;
+    lock_release(&free_map_lock);
+}
+
+/* Makes every sector released since the last call free for
+ * reuse.  Only call this once the inode changes that released
+ * them are on disk. */
+void free_map_commit_releases(void)
+{
+    size_t sector;
+
+    lock_acquire(&free_map_lock);
+    for (sector = 0; release_cnt > 0 && sector < bitmap_size(release_map); sector++)
+    {
+        if (bitmap_test(release_map, sector))
+        {
+            bitmap_reset(release_map, sector);
+            bitmap_reset(free_map, sector);
+            mark_dirty(sector, 1);
+            release_cnt--;
+        }
+    }
+    lock_release(&free_map_lock);
+}
+
+/* Writes the dirty parts of the free map to the free map file.
+ * With a journal they join the running transaction.  Without one
+ * they go straight on to disk, so the inodes that a later cache
+ * flush writes never point at sectors still free there.
+ *
+ * Each part is copied out under the lock and written after it is
+ * released, inside a journal operation begun before taking it, so
+ * the write never waits on a commit that needs the lock.  The
+ * commit runs only while no operation is open, so a part can't be
+ * written over by an older copy of it. */
+void free_map_flush(void)
+{
+    static uint8_t buffer[BLOCK_SECTOR_SIZE];
+    size_t i;
+
+    for (i = 0; i < bitmap_size(dirty_map); i++)
+    {
+        off_t ofs = i * BLOCK_SECTOR_SIZE;
+        struct file *file;
+        size_t size = 0;
+
+        journal_begin();
+        lock_acquire(&free_map_lock);
+        file = free_map_file;
+        if (file != NULL && bitmap_test(dirty_map, i))
+        {
+            size = bitmap_copy_part(free_map, buffer, ofs, BLOCK_SECTOR_SIZE);
+            bitmap_reset(dirty_map, i);
+        }
+        lock_release(&free_map_lock);
+
+        if (size > 0 && file_write_at(file, buffer, size, ofs) != (off_t)size)
+        {
+            log(L_ERROR, "can't write free map sector [%d]", i);
+            lock_acquire(&free_map_lock);
+            bitmap_mark(dirty_map, i);
+            lock_release(&free_map_lock);
+            size = 0;
+        }
+        journal_end();
+
+        /* Journal pending sectors stay put */
+        if (size > 0)
+        {
+            cache_flush_sector(inode_sector_at(file_get_inode(file), ofs));
+        }
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -77,7 +304,14 @@ void free_map_open(void)
 /* Writes the free map to disk and closes the free map file. */
 void free_map_close(void)
 {
-    file_close(free_map_file);
+    struct file *file;
+
+    free_map_flush();
+    lock_acquire(&free_map_lock);
+    file = free_map_file;
+    free_map_file = NULL;
+    lock_release(&free_map_lock);
+    file_close(file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -100,4 +334,5 @@ void free_map_create(void)
     {
         PANIC("can't write free map");
     }
+    bitmap_set_all(dirty_map, false);
 }
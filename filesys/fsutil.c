@@ -16,7 +16,8 @@
 void fsutil_ls(char **argv UNUSED)
 {
     struct dir *dir;
-    char name[NAME_MAX + 1];
+    struct dirent ents[16];
+    int cnt, i;
 
     printf("Files in the root directory:\n");
     dir = dir_open_root();
@@ -24,9 +25,12 @@ void fsutil_ls(char **argv UNUSED)
     {
         PANIC("root dir open failed");
     }
-    while (dir_readdir(dir, name))
+    while ((cnt = dir_readdir_bulk(dir, ents, sizeof ents / sizeof *ents)) > 0)
     {
-        printf("%s\n", name);
+        for (i = 0; i < cnt; i++)
+        {
+            printf("%s\n", ents[i].d_name);
+        }
     }
     dir_close(dir);
     printf("End of listing.\n");
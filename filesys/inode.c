@@ -1,10 +1,13 @@
 #include <debug.h>
 #include <round.h>
+#include <stat.h>
 #include <string.h>
 
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #define LOGGING_LEVEL 6
 #include <log.h>
@@ -12,9 +15,30 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-static bool inode_alloc(struct inode_disk *inode_disk);
-static bool inode_save(struct inode_disk *inode_disk, off_t length);
+/* Most sectors writing one sector of a file can log: the index
+ * blocks on its path, the inode, and the sector itself for
+ * directories. */
+#define WRITE_LOG_MAX 5
+
+/* Most sectors one extent_append() can log. */
+#define EXTENT_LOG_MAX 2
+
+/* -extents: Give new regular files the extent layout? */
+bool inode_use_extents;
+
+/* -inline: Keep tiny regular files inside their inode? */
+bool inode_use_inline;
+
+static bool inode_alloc(struct inode_disk *inode_disk, block_sector_t goal);
+static bool inode_save(struct inode_disk *inode_disk, off_t length, block_sector_t goal);
 static bool inode_dealloc(struct inode *inode);
+static block_sector_t extent_idx_sect(struct inode *inode, off_t index);
+static block_sector_t inode_fill_hole(struct inode *inode, off_t index);
+static bool inode_migrate_inline(struct inode *inode);
+static void inode_mark_dirty(struct inode *inode);
+static bool extent_save(struct inode_disk *inode_disk, off_t length, block_sector_t goal);
+static void extent_dealloc(struct inode_disk *inode_disk);
+static size_t inode_mapped_sectors(const struct inode_disk *inode_disk);
 
 /* Returns the number of sectors to allocate for an inode SIZE
  * bytes long. */
@@ -24,69 +48,303 @@ bytes_to_sectors(off_t size)
     return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns true if INODE_DISK uses one of the indexed layouts. */
+static inline bool
+is_indexed(const struct inode_disk *inode_disk)
+{
+    return inode_disk->layout == INODE_LAYOUT_INDEXED || inode_disk->layout == INODE_LAYOUT_TRIPLE;
+}
+
+/* Returns the number of direct blocks of an indexed inode, the index
+ * block pointers come right after them in index_table. */
+static inline size_t
+index_direct_cnt(const struct inode_disk *inode_disk)
+{
+    return inode_disk->layout == INODE_LAYOUT_TRIPLE ? NUMBER_TRIPLE_DIRECT_BLOCKS : NUMBER_DIRECT_BLOCKS;
+}
+
+/* Returns how many levels of index blocks an indexed inode has. */
+static inline int
+index_levels(const struct inode_disk *inode_disk)
+{
+    return inode_disk->layout == INODE_LAYOUT_TRIPLE ? 3 : 2;
+}
+
+/* Returns the most sectors an indexed inode can map. */
+static size_t
+index_max_sectors(const struct inode_disk *inode_disk)
+{
+    size_t max = index_direct_cnt(inode_disk) + NUMBER_INDIRECT_BLOCKS_PER_SECTOR + NUMBER_BLOCKS_D_INDIRECT;
+    if (inode_disk->layout == INODE_LAYOUT_TRIPLE)
+    {
+        max += NUMBER_BLOCKS_T_INDIRECT;
+    }
+    return max;
+}
+
+/*
+Finds where block INDEX of an indexed inode is mapped. Returns how many
+index blocks are above it (0 for a direct block) and stores the slot to
+follow at each level in PATH, PATH[0] being the slot in index_table.
+Returns -1 if INDEX is past what the layout can map
+*/
+static int index_path(const struct inode_disk *inode_disk, off_t index, size_t path[4])
+{
+    size_t direct_cnt = index_direct_cnt(inode_disk);
+    size_t span = 1;
+    int lvl, i;
+
+    if (index < (off_t)direct_cnt)
+    {
+        path[0] = index;
+        return 0;
+    }
+    index -= direct_cnt;
+    for (lvl = 1; lvl <= index_levels(inode_disk); lvl++)
+    {
+        span *= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+        if (index < (off_t)span)
+        {
+            path[0] = direct_cnt + lvl - 1;
+            for (i = lvl; i > 0; i--)
+            {
+                path[i] = index % NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+                index /= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+            }
+            return lvl;
+        }
+        index -= span;
+    }
+    return -1;
+}
+
+/*
+Returns the cached copy of the index block in SECTOR, stored in *SLOT,
+reading it through the buffer cache on first use.
+Returns a null pointer if memory allocation fails.
+The inode's map_lock must be held.
+*/
+static void *map_load(void **slot, block_sector_t sector)
+{
+    if (*slot == NULL)
+    {
+        *slot = malloc(BLOCK_SECTOR_SIZE);
+        if (*slot == NULL)
+        {
+            return NULL;
+        }
+        cache_read(sector, *slot);
+        log(L_DEBUG, "Block Map Loaded | Index Block Sector: [%d] ", sector);
+    }
+    return *slot;
+}
+
+/*
+Drops every index block cached in INODE's block map, so the next
+lookup reads them again. Called whenever the index blocks change on disk.
+*/
+static void map_invalidate(struct inode *inode)
+{
+    size_t i;
+
+    lock_acquire(&inode->map_lock);
+    free(inode->map_indirect);
+    inode->map_indirect = NULL;
+    free(inode->map_d_indirect);
+    inode->map_d_indirect = NULL;
+    if (inode->map_d_indirect_l2 != NULL)
+    {
+        for (i = 0; i < NUMBER_INDIRECT_BLOCKS_PER_SECTOR; i++)
+        {
+            free(inode->map_d_indirect_l2[i]);
+        }
+        free(inode->map_d_indirect_l2);
+        inode->map_d_indirect_l2 = NULL;
+    }
+    free(inode->map_extent_index);
+    inode->map_extent_index = NULL;
+    if (inode->map_extent_leaves != NULL)
+    {
+        for (i = 0; i < NUMBER_EXTENT_LEAVES; i++)
+        {
+            free(inode->map_extent_leaves[i]);
+        }
+        free(inode->map_extent_leaves);
+        inode->map_extent_leaves = NULL;
+    }
+    lock_release(&inode->map_lock);
+}
+
+/*
+Given an extent inode and an index, it returns the sector
+The extents in the inode are scanned first, then the overflow tree is
+searched by the first index of each leaf.
+returns -1 if the index is past the last allocated sector
+*/
+static block_sector_t extent_idx_sect(struct inode *inode, off_t index)
+{
+    const struct inode_disk *inode_disk = &inode->data;
+    struct extent_index *extent_index;
+    struct extent_leaf *leaf;
+    block_sector_t sector = -1;
+    off_t first = 0;
+    size_t i, cnt, leaf_cnt, lo = 0, hi;
+
+    if (index < 0 || index >= (off_t)inode_disk->extent_sectors)
+    {
+        return -1;
+    }
+
+    /* Extents in the inode */
+    cnt = inode_disk->extent_cnt < NUMBER_INODE_EXTENTS ? inode_disk->extent_cnt : NUMBER_INODE_EXTENTS;
+    for (i = 0; i < cnt; i++)
+    {
+        const struct inode_extent *e = &inode_disk->extents[i];
+        if (index < first + (off_t)e->length)
+        {
+            return e->start + (index - first);
+        }
+        first += e->length;
+    }
+
+    /* Overflow tree, find the last leaf starting at or before INDEX */
+    leaf_cnt = DIV_ROUND_UP(inode_disk->extent_cnt - NUMBER_INODE_EXTENTS, NUMBER_LEAF_EXTENTS);
+    lock_acquire(&inode->map_lock);
+    extent_index = map_load((void **)&inode->map_extent_index, inode_disk->extent_index_sec);
+    if (extent_index != NULL && inode->map_extent_leaves == NULL)
+    {
+        inode->map_extent_leaves = calloc(NUMBER_EXTENT_LEAVES, sizeof *inode->map_extent_leaves);
+    }
+    if (extent_index != NULL && inode->map_extent_leaves != NULL)
+    {
+        lo = 0;
+        hi = leaf_cnt;
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            if ((off_t)extent_index->leaves[mid].first_index <= index)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        leaf = map_load((void **)&inode->map_extent_leaves[lo], extent_index->leaves[lo].sector);
+        if (leaf != NULL)
+        {
+            first = extent_index->leaves[lo].first_index;
+            for (i = 0; i < leaf->extent_cnt; i++)
+            {
+                const struct inode_extent *e = &leaf->extents[i];
+                if (index < first + (off_t)e->length)
+                {
+                    sector = e->start + (index - first);
+                    break;
+                }
+                first += e->length;
+            }
+        }
+    }
+    lock_release(&inode->map_lock);
+    log(L_DEBUG, "Extent Tree | Leaf: [%d] | Block Sector: [%d] ", lo, sector);
+    return sector;
+}
+
 /*
-Given an disk inode and and index, it returns the sector
-returns -1 if went wrong
+Given an inode and and index, it returns the sector
+Index blocks down to the double indirect level are kept in the inode's
+block map after the first lookup, so only the first touch of each one
+costs a read.
+returns 0 for a hole (never written, reads as zeros), -1 if went wrong
 */
-static block_sector_t idx_sect(const struct inode_disk *inode_disk, off_t index)
+static block_sector_t idx_sect(struct inode *inode, off_t index)
 {
-    log(L_TRACE, "idx_sect(inode_disk: [%08x], index: [%d])", inode_disk, index);
-    off_t index_start = 0;
+    log(L_TRACE, "idx_sect(inode: [%08x], index: [%d])", inode, index);
+    const struct inode_disk *inode_disk = &inode->data;
+    struct indirect_block *indirect_block;
     block_sector_t sector;
+    size_t path[4];
+    int i, lvl;
+
+    if (inode_disk->layout == INODE_LAYOUT_EXTENT)
+    {
+        return extent_idx_sect(inode, index);
+    }
+    if (inode_disk->layout == INODE_LAYOUT_INLINE)
+    {
+        /* Data lives in the inode, no sectors */
+        return -1;
+    }
+
+    lvl = index_path(inode_disk, index, path);
+    if (lvl < 0)
+    {
+        /* if everything went wrong ie a file too big */
+        log(L_ERROR, "Everything when wrong");
+        return -1;
+    }
+    sector = inode_disk->index_table[path[0]];
 
-    /* Direct Mappings*/
-    off_t index_max = NUMBER_DIRECT_BLOCKS;
-    if (index < index_max)
+    /* Direct Mappings, or nothing allocated below this pointer yet */
+    if (lvl == 0 || sector == 0)
     {
-        sector = inode_disk->direct_map_table[index];
         log(L_DEBUG, "Direct Mapping | Block Sector: [%d] ", sector);
         return sector;
     }
-    index_start = index_max;
 
-    /* Using the single Indirect Block, so add the new limit to index_max + 128 */
-    index_max += NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
-    if (index < index_max)
+    /* Using the single Indirect Block */
+    if (lvl == 1)
     {
-        struct indirect_block *indirect_block;
-        indirect_block = calloc(1, sizeof(struct indirect_block));
-        block_read(fs_device, inode_disk->indirect_block_sec, indirect_block); /* Read what is ther everything to disk */
+        lock_acquire(&inode->map_lock);
+        indirect_block = map_load((void **)&inode->map_indirect, sector);
+        sector = indirect_block != NULL ? indirect_block->blocks[path[1]] : -1u;
+        lock_release(&inode->map_lock);
         log(L_DEBUG, "Single Indirect | Block Sector: [%d] ", sector);
-        sector = indirect_block->blocks[index - index_start];
-        free(indirect_block);
         return sector;
     }
-    index_start = index_max;
-
-    /* Using the Double Indirect Block, so add the new limit to index_max (128*128) */
-    index_max += NUMBER_BLOCKS_D_INDIRECT;
-    if (index < index_max)
-    {
-        /* Getting the index of both levels */
-        off_t index_first = (index - index_start) / NUMBER_INDIRECT_BLOCKS_PER_SECTOR;  /* Gets the block it is on in first lvl*/
-        off_t index_second = (index - index_start) % NUMBER_INDIRECT_BLOCKS_PER_SECTOR; /* Gets the index on the second lvl*/
-        /* Read what is there*/
-        struct indirect_block *indirect_block;
-        indirect_block = calloc(1, sizeof(struct indirect_block));
-        block_read(fs_device, inode_disk->double_indirect_block_sec, indirect_block); /* Read what is ther everything to disk */
-        block_read(fs_device, indirect_block->blocks[index_first], indirect_block);
-        log(L_DEBUG, "Double Indirect | Index 1: [%d] | Index 2: [%d] | Block Sector: [%d] ", index_first, index_second, sector);
-        sector = indirect_block->blocks[index_second];
-        free(indirect_block);
+
+    /* Using the Double Indirect Block, both levels are kept in the block map */
+    if (lvl == 2)
+    {
+        lock_acquire(&inode->map_lock);
+        indirect_block = map_load((void **)&inode->map_d_indirect, sector);
+        sector = -1;
+        if (indirect_block != NULL && inode->map_d_indirect_l2 == NULL)
+        {
+            inode->map_d_indirect_l2 = calloc(NUMBER_INDIRECT_BLOCKS_PER_SECTOR, sizeof *inode->map_d_indirect_l2);
+        }
+        if (indirect_block != NULL && indirect_block->blocks[path[1]] == 0)
+        {
+            sector = 0;
+        }
+        else if (indirect_block != NULL && inode->map_d_indirect_l2 != NULL)
+        {
+            indirect_block = map_load((void **)&inode->map_d_indirect_l2[path[1]], indirect_block->blocks[path[1]]);
+            if (indirect_block != NULL)
+            {
+                sector = indirect_block->blocks[path[2]];
+            }
+        }
+        lock_release(&inode->map_lock);
+        log(L_DEBUG, "Double Indirect | Index 1: [%d] | Index 2: [%d] | Block Sector: [%d] ", path[1], path[2], sector);
         return sector;
     }
-    /* if everything went wrong ie a file too big */
-    log(L_ERROR, "Everything when wrong");
-    return -1;
+
+    /* Using the Triple Indirect Block.  Too big to keep in memory, so
+     * walk it through the buffer cache, one pointer per level */
+    for (i = 1; i <= lvl && sector != 0; i++)
+    {
+        cache_read_at(sector, &sector, path[i] * sizeof sector, sizeof sector);
+    }
+    log(L_DEBUG, "Triple Indirect | Index 1: [%d] | Index 2: [%d] | Index 3: [%d] | Block Sector: [%d] ", path[1], path[2], path[3], sector);
+    return sector;
 }
 
 /* Returns the block device sector that contains byte offset POS
  * within INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * POS, or 0 if POS falls in a hole. */
 
 static block_sector_t
-byte_to_sector(const struct inode *inode, off_t pos)
+byte_to_sector(struct inode *inode, off_t pos)
 {
     /*
      * Modify, for file Extension
@@ -97,20 +355,79 @@ byte_to_sector(const struct inode *inode, off_t pos)
     {
         /*Sector Index*/
         off_t index = pos / BLOCK_SECTOR_SIZE;
-        return idx_sect(&inode->data, index);
+        return idx_sect(inode, index);
     }
     else
         return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed by sector, so that opening a single
+ * inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock; /* Protects OPEN_INODES, every open_cnt and deny_write_cnt. */
+static size_t dirty_inode_cnt;       /* Open inodes with the dirty flag set. */
+
+static unsigned
+open_inode_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+static bool
+open_inode_less(const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+    return hash_entry(a, struct inode, elem)->sector < hash_entry(b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void inode_init(void)
 {
-    list_init(&open_inodes);
+    hash_init(&open_inodes, open_inode_hash, open_inode_less, NULL);
+    lock_init(&open_inodes_lock);
+    dirty_inode_cnt = 0;
+}
+
+/* Notes that INODE's on-disk copy is out of date.  It is written on
+ * the last close or by the next inode_flush(), not on every change. */
+static void inode_mark_dirty(struct inode *inode)
+{
+    if (!inode->dirty)
+    {
+        lock_acquire(&open_inodes_lock);
+        inode->dirty = true;
+        dirty_inode_cnt++;
+        lock_release(&open_inodes_lock);
+        /* The commit logs it for us */
+        journal_charge(1);
+    }
+}
+
+/* Writes every dirty open inode to disk.  Runs as part of a journal
+ * commit, when no operation can be changing them. */
+void inode_flush(void)
+{
+    struct hash_iterator i;
+
+    lock_acquire(&open_inodes_lock);
+    hash_first(&i, &open_inodes);
+    while (hash_next(&i))
+    {
+        struct inode *inode = hash_entry(hash_cur(&i), struct inode, elem);
+        if (inode->dirty)
+        {
+            journal_write(inode->sector, &inode->data);
+            inode->dirty = false;
+            dirty_inode_cnt--;
+        }
+    }
+    lock_release(&open_inodes_lock);
+}
+
+/* Returns how many open inodes wait to be written. */
+size_t inode_dirty_cnt(void)
+{
+    return dirty_inode_cnt;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -140,10 +457,16 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir)
         disk_inode->length = length;
         disk_inode->magic = INODE_MAGIC;
         disk_inode->isDir = is_dir;
-        if (inode_alloc(disk_inode))
+        if (is_dir)
+            disk_inode->layout = INODE_LAYOUT_TRIPLE;
+        else if (inode_use_inline && length <= INODE_INLINE_SIZE)
+            disk_inode->layout = INODE_LAYOUT_INLINE;
+        else
+            disk_inode->layout = inode_use_extents ? INODE_LAYOUT_EXTENT : INODE_LAYOUT_TRIPLE;
+        if (inode_alloc(disk_inode, sector))
         {
             /* Write from the disk */
-            block_write(fs_device, sector, disk_inode);
+            journal_write(sector, disk_inode);
             success = true;
         }
         free(disk_inode);
@@ -158,37 +481,52 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open(block_sector_t sector)
 {
-    struct list_elem *e;
+    struct inode key;
+    struct hash_elem *e;
     struct inode *inode;
 
     /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-         e = list_next(e))
+    lock_acquire(&open_inodes_lock);
+    key.sector = sector;
+    e = hash_find(&open_inodes, &key.elem);
+    if (e != NULL)
     {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector)
-        {
-            inode_reopen(inode);
-            return inode;
-        }
+        inode = hash_entry(e, struct inode, elem);
+        inode->open_cnt++;
+        lock_release(&open_inodes_lock);
+        return inode;
     }
 
     /* Allocate memory. */
     inode = malloc(sizeof *inode);
     if (inode == NULL)
     {
+        lock_release(&open_inodes_lock);
         return NULL;
     }
 
-    /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
+    /* Initialize.  The lock is held until the inode is read in so
+     * nobody else can find it half set up. */
     inode->sector = sector;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
-    lock_init(&inode->lock);
+    inode->dirty = false;
+    rwlock_init(&inode->rwlock);
+    rwlock_init(&inode->dir_lock);
+    lock_init(&inode->range_lock);
+    list_init(&inode->ranges);
+    cond_init(&inode->range_freed);
+    lock_init(&inode->map_lock);
+    inode->map_indirect = NULL;
+    inode->map_d_indirect = NULL;
+    inode->map_d_indirect_l2 = NULL;
+    inode->map_extent_index = NULL;
+    inode->map_extent_leaves = NULL;
     /* Read from the disk */
-    block_read(fs_device, inode->sector, &inode->data);
+    cache_read(inode->sector, &inode->data);
+    hash_insert(&open_inodes, &inode->elem);
+    lock_release(&open_inodes_lock);
     return inode;
 }
 
@@ -198,7 +536,9 @@ inode_reopen(struct inode *inode)
 {
     if (inode != NULL)
     {
+        lock_acquire(&open_inodes_lock);
         inode->open_cnt++;
+        lock_release(&open_inodes_lock);
     }
     return inode;
 }
@@ -210,11 +550,24 @@ inode_get_inumber(const struct inode *inode)
     return inode->sector;
 }
 
+/* Returns the sector holding byte POS of INODE, 0 for a hole, or
+ * -1 if POS is past what the layout can map. */
+block_sector_t inode_sector_at(struct inode *inode, off_t pos)
+{
+    block_sector_t sector;
+
+    rwlock_acquire_read(&inode->rwlock);
+    sector = byte_to_sector(inode, pos);
+    rwlock_release_read(&inode->rwlock);
+    return sector;
+}
+
 /* Closes INODE and writes it to disk.
  * If this was the last reference to INODE, frees its memory.
  * If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode *inode)
 {
+    bool in_op = false;
 
     /* Ignore null pointer. */
     if (inode == NULL)
@@ -222,21 +575,54 @@ void inode_close(struct inode *inode)
         return;
     }
 
-    /* Release resources if this was the last opener. */
-    if (--inode->open_cnt == 0)
+    /* The last opener writes a dirty inode back while it is still in
+     * the table, so a concurrent inode_open() finds this copy rather
+     * than reading a stale one from disk.  The journal operation has
+     * to start before taking the table lock. */
+    lock_acquire(&open_inodes_lock);
+    if (inode->open_cnt == 1 && inode->dirty && !inode->removed)
     {
-        /* Remove from inode list and release lock. */
-        list_remove(&inode->elem);
+        lock_release(&open_inodes_lock);
+        journal_begin();
+        in_op = true;
+        lock_acquire(&open_inodes_lock);
+    }
 
-        /* Deallocate blocks if removed. */
-        if (inode->removed)
+    /* Someone opened it meanwhile, or not the last opener */
+    if (--inode->open_cnt > 0)
+    {
+        lock_release(&open_inodes_lock);
+        if (in_op)
         {
-            free_map_release(inode->sector, 1);
-            inode_dealloc(inode);
+            journal_end();
+        }
+        return;
+    }
+    if (inode->dirty)
+    {
+        if (!inode->removed)
+        {
+            journal_write(inode->sector, &inode->data);
         }
+        inode->dirty = false;
+        dirty_inode_cnt--;
+    }
+    hash_delete(&open_inodes, &inode->elem);
+    lock_release(&open_inodes_lock);
+    if (in_op)
+    {
+        journal_end();
+    }
 
-        free(inode);
+    /* Deallocate blocks if removed. */
+    if (inode->removed)
+    {
+        free_map_release(inode->sector, 1);
+        inode_dealloc(inode);
     }
+
+    map_invalidate(inode);
+    free(inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -247,16 +633,89 @@ void inode_remove(struct inode *inode)
     inode->removed = true;
 }
 
+/* A byte range [START, END) of a file held by one reader or writer. */
+struct inode_range
+{
+    struct list_elem elem; /* Element in the inode's RANGES list. */
+    off_t start;           /* First byte. */
+    off_t end;             /* One past the last byte. */
+    bool exclusive;        /* Held by a writer? */
+};
+
+/* Returns true if RANGE overlaps a range already held on INODE that
+ * it can't share.  The inode's range_lock must be held. */
+static bool range_conflicts(struct inode *inode, const struct inode_range *range)
+{
+    struct list_elem *e;
+
+    for (e = list_begin(&inode->ranges); e != list_end(&inode->ranges); e = list_next(e))
+    {
+        struct inode_range *held = list_entry(e, struct inode_range, elem);
+        if (held->start < range->end && range->start < held->end && (held->exclusive || range->exclusive))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Locks bytes START up to END of INODE, shared for readers and exclusive
+for writers, waiting for any overlapping range in the way. RANGE is
+filled in and must stay alive until range_release(). The inode's rwlock
+must be held for reading
+*/
+static void range_acquire(struct inode *inode, struct inode_range *range, off_t start, off_t end, bool exclusive)
+{
+    range->start = start;
+    range->end = end;
+    range->exclusive = exclusive;
+
+    lock_acquire(&inode->range_lock);
+    while (range_conflicts(inode, range))
+    {
+        cond_wait(&inode->range_freed, &inode->range_lock);
+    }
+    list_push_back(&inode->ranges, &range->elem);
+    lock_release(&inode->range_lock);
+}
+
+/* Unlocks RANGE of INODE and wakes up whoever waits on it. */
+static void range_release(struct inode *inode, struct inode_range *range)
+{
+    lock_acquire(&inode->range_lock);
+    list_remove(&range->elem);
+    cond_broadcast(&inode->range_freed, &inode->range_lock);
+    lock_release(&inode->range_lock);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
  * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
+ * than SIZE if an error occurs or end of file is reached.
+ * Readers share the inode, so they only wait for writers of the
+ * same bytes or for the file changing length. */
 off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
     log(L_TRACE, "inode_read_at(inode: [%08x], size: [%d], offset: [%d] )", inode, size, offset);
     uint8_t *buffer = buffer_;
     off_t bytes_read = 0;
-    uint8_t *bounce = NULL;
+    struct inode_range range;
+
+    rwlock_acquire_read(&inode->rwlock);
+
+    /* Inline file, copy straight out of the inode */
+    if (inode->data.layout == INODE_LAYOUT_INLINE)
+    {
+        if (offset < inode->data.length)
+        {
+            bytes_read = inode->data.length - offset < size ? inode->data.length - offset : size;
+            memcpy(buffer, inode->data.inline_data + offset, bytes_read);
+        }
+        rwlock_release_read(&inode->rwlock);
+        return bytes_read;
+    }
 
+    range_acquire(inode, &range, offset, size < inode_length(inode) - offset ? offset + size : inode_length(inode), false);
     while (size > 0)
     {
         log(L_DEBUG, "Size:[%d]", size);
@@ -276,67 +735,84 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
             break;
         }
 
-        if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-            /* Read full sector directly into caller's buffer. */
-            block_read(fs_device, sector_idx, buffer + bytes_read);
-        }
+        /* Copy the chunk out of the buffer cache, holes read as zeros. */
+        if (sector_idx == 0)
+            memset(buffer + bytes_read, 0, chunk_size);
         else
-        {
-            /* Read sector into bounce buffer, then partially copy
-             * into caller's buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc(BLOCK_SECTOR_SIZE);
-                if (bounce == NULL)
-                {
-                    break;
-                }
-            }
-            block_read(fs_device, sector_idx, bounce);
-            memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+            cache_read_at(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_read += chunk_size;
     }
-    free(bounce);
+    range_release(inode, &range);
+    rwlock_release_read(&inode->rwlock);
 
     return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
-off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
-                     off_t offset)
+/* Queues prefetch of the sectors of INODE holding bytes START up to
+ * END, so later reads find them in the buffer cache.  Holes and
+ * bytes past the end of the file are skipped. */
+void inode_readahead(struct inode *inode, off_t start, off_t end)
 {
-    // log(L_TRACE, "inode_write_at(inode: [%08x], size: [%d], offset: [%d] )", inode, size, offset);
-    const uint8_t *buffer = buffer_;
-    off_t bytes_written = 0;
-    uint8_t *bounce = NULL;
+    off_t pos;
 
-    if (inode->deny_write_cnt)
-        return 0;
-    lock_acquire(&inode->lock);
-    /* For Writing beyond EOF*/
-    if (byte_to_sector(inode, offset + size - 1) == -1u)
+    rwlock_acquire_read(&inode->rwlock);
+    if (end > inode_length(inode))
     {
-        bool success;
-        success = inode_save(&inode->data, offset + size);
-        if (!success)
+        end = inode_length(inode);
+    }
+    for (pos = ROUND_DOWN(start, BLOCK_SECTOR_SIZE); pos < end; pos += BLOCK_SECTOR_SIZE)
+    {
+        block_sector_t sector = byte_to_sector(inode, pos);
+        if (sector != 0 && sector != -1u)
         {
-            lock_release(&inode->lock);
-            return 0;
+            cache_prefetch(sector);
+        }
+    }
+    rwlock_release_read(&inode->rwlock);
+}
+
+/* Returns true if bytes OFFSET up to OFFSET + SIZE of INODE are inside
+ * the file and all have sectors, so writing them changes nothing but
+ * data.  The inode's rwlock must be held. */
+static bool inode_in_place(struct inode *inode, off_t offset, off_t size)
+{
+    off_t pos;
+
+    if (inode->data.layout == INODE_LAYOUT_INLINE || offset + size > inode_length(inode))
+    {
+        return false;
+    }
+    for (pos = ROUND_DOWN(offset, BLOCK_SECTOR_SIZE); pos < offset + size; pos += BLOCK_SECTOR_SIZE)
+    {
+        block_sector_t sector = byte_to_sector(inode, pos);
+        if (sector == 0 || sector == -1u)
+        {
+            return false;
         }
-        /* Write Back to Disk */
-        inode->data.length = offset + size;
-        block_write(fs_device, inode->sector, &inode->data);
     }
+    return true;
+}
+
+/* Returns true if the contents of INODE are metadata, which goes
+ * through the journal like the inode itself. */
+static bool inode_is_meta(const struct inode *inode)
+{
+    return inode->data.isDir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Copies SIZE bytes from BUFFER into the sectors of INODE starting at
+ * OFFSET, stopping at the end of the file.  Holes get a sector first,
+ * which needs the inode's rwlock held for writing.  Also stops before
+ * a sector that would log more than the running journal operation
+ * has room for. */
+static off_t inode_write_sectors(struct inode *inode, const uint8_t *buffer, off_t size, off_t offset)
+{
+    off_t bytes_written = 0;
+    bool meta = inode_is_meta(inode);
 
     while (size > 0)
     {
@@ -356,66 +832,335 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
             break;
         }
 
-        if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+        /* Past what the layout can map */
+        if (sector_idx == -1u)
         {
-            /* Write full sector directly to disk. */
-            block_write(fs_device, sector_idx, buffer + bytes_written);
+            log(L_ERROR, "no sector for offset [%d]", offset);
+            break;
         }
-        else
+
+        /* The rest goes into another journal operation */
+        if ((sector_idx == 0 || meta) && !journal_has_room(WRITE_LOG_MAX))
         {
-            /* We need a bounce buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc(BLOCK_SECTOR_SIZE);
-                if (bounce == NULL)
-                {
-                    break;
-                }
-            }
+            break;
+        }
 
-            /* If the sector contains data before or after the chunk
-             * we're writing, then we need to read in the sector
-             * first.  Otherwise we start with a sector of all zeros. */
-            if (sector_ofs > 0 || chunk_size < sector_left)
-            {
-                block_read(fs_device, sector_idx, bounce);
-            }
-            else
+        /* First write to a hole, give it a sector */
+        if (sector_idx == 0)
+        {
+            ASSERT(rwlock_held_for_write(&inode->rwlock));
+            sector_idx = inode_fill_hole(inode, offset / BLOCK_SECTOR_SIZE);
+            if (sector_idx == 0)
             {
-                memset(bounce, 0, BLOCK_SECTOR_SIZE);
+                log(L_ERROR, "could not allocate");
+                break;
             }
-            memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-            block_write(fs_device, sector_idx, bounce);
         }
 
+        /* Copy the chunk into the buffer cache, which writes it
+         * back to disk later. */
+        if (meta)
+            journal_write_at(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+        else
+            cache_write_at(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_written += chunk_size;
     }
-
-    free(bounce);
-    // log(L_DEBUG, "bytes written: [%d]", bytes_written);
-    lock_release(&inode->lock);
     return bytes_written;
 }
 
-/* Disables writes to INODE.
- * May be called at most once per inode opener. */
-void inode_deny_write(struct inode *inode)
+/* Writes up to SIZE bytes from BUFFER into INODE at OFFSET, growing
+ * the file and filling holes as needed.  Stops early once the running
+ * journal operation is low on room.  Returns the number of bytes
+ * written, which is 0 if only the file grew, or -1 on failure.  The
+ * inode's rwlock must be held for writing. */
+static off_t inode_write_grow(struct inode *inode, const uint8_t *buffer, off_t size, off_t offset)
 {
-    inode->deny_write_cnt++;
-    ASSERT(inode->deny_write_cnt <= inode->open_cnt);
-}
+    off_t old_length = inode_length(inode);
+    off_t end = offset + size;
+    off_t bytes_written;
 
-/* Re-enables writes to INODE.
- * Must be called once by each inode opener who has called
- * inode_deny_write() on the inode, before closing the inode. */
+    /* Inline file, write into the inode while it still fits, or else
+     * move it out to a data block first */
+    if (inode->data.layout == INODE_LAYOUT_INLINE)
+    {
+        if (end <= INODE_INLINE_SIZE)
+        {
+            memcpy(inode->data.inline_data + offset, buffer, size);
+            if (end > inode->data.length)
+            {
+                inode->data.length = end;
+            }
+            inode_mark_dirty(inode);
+            return size;
+        }
+        if (!inode_migrate_inline(inode))
+        {
+            return -1;
+        }
+    }
+    /* For Writing beyond EOF*/
+    if (byte_to_sector(inode, end - 1) == -1u)
+    {
+        if (!inode_save(&inode->data, end, inode->sector))
+        {
+            return -1;
+        }
+        /* The index blocks just changed, so the block map is stale */
+        map_invalidate(inode);
+        /* An extent file may have only grown part of the way */
+        if (inode->data.layout == INODE_LAYOUT_EXTENT && (off_t)inode->data.extent_sectors * BLOCK_SECTOR_SIZE < end)
+        {
+            end = inode->data.extent_sectors * BLOCK_SECTOR_SIZE;
+        }
+        if (end > inode->data.length)
+        {
+            inode->data.length = end;
+            inode_mark_dirty(inode);
+        }
+        if (end <= offset)
+        {
+            return 0;
+        }
+    }
+
+    bytes_written = inode_write_sectors(inode, buffer, end - offset, offset);
+
+    /* Ran out of space, don't leave the file longer than what was written */
+    if (offset + bytes_written < end && inode_length(inode) > old_length)
+    {
+        inode->data.length = offset + bytes_written > old_length ? offset + bytes_written : old_length;
+        inode_mark_dirty(inode);
+    }
+    return bytes_written > 0 ? bytes_written : -1;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if the disk fills up or an error occurs.
+ * Writes over bytes that already have sectors only lock their own
+ * range, so they run alongside readers and other writers, and only
+ * join the journal if the file is metadata.  Growing the file or
+ * filling holes takes the whole inode, in as many journal operations
+ * as it needs room for. */
+off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size,
+                     off_t offset)
+{
+    // log(L_TRACE, "inode_write_at(inode: [%08x], size: [%d], offset: [%d] )", inode, size, offset);
+    const uint8_t *buffer = buffer_;
+    off_t bytes_written = 0;
+    struct inode_range range;
+    bool meta = inode_is_meta(inode);
+    bool in_place;
+
+    if (inode->deny_write_cnt)
+        return 0;
+
+    /* Overwrite in place, plain data changes no metadata.  Metadata
+     * goes in as many journal operations as it needs room for, each
+     * opened before the rwlock is taken. */
+    do
+    {
+        off_t chunk = 0;
+
+        if (meta)
+            journal_begin();
+        rwlock_acquire_read(&inode->rwlock);
+        in_place = inode_in_place(inode, offset + bytes_written, size - bytes_written);
+        if (in_place)
+        {
+            range_acquire(inode, &range, offset + bytes_written, offset + size, true);
+            chunk = inode_write_sectors(inode, buffer + bytes_written, size - bytes_written, offset + bytes_written);
+            range_release(inode, &range);
+        }
+        rwlock_release_read(&inode->rwlock);
+        if (meta)
+            journal_end();
+        if (chunk == 0)
+            break;
+        bytes_written += chunk;
+    } while (bytes_written < size);
+    if (in_place)
+        return bytes_written;
+
+    /* Growing or filling a hole changes the inode and index blocks */
+    while (bytes_written < size)
+    {
+        off_t chunk;
+
+        journal_begin();
+        rwlock_acquire_write(&inode->rwlock);
+        chunk = inode_write_grow(inode, buffer + bytes_written, size - bytes_written, offset + bytes_written);
+        rwlock_release_write(&inode->rwlock);
+        journal_end();
+        if (chunk < 0)
+        {
+            break;
+        }
+        bytes_written += chunk;
+    }
+
+    // log(L_DEBUG, "bytes written: [%d]", bytes_written);
+    return bytes_written;
+}
+
+/*
+Copies sector FROM over the sector of DST that starts at byte OFS, inside
+the buffer cache. The sector must be inside DST already, a hole in an
+indexed file is filled first. Returns false if it's not there, or DST is
+something that needs the slow path (inline, metadata, writes denied)
+*/
+static bool inode_copy_sector(struct inode *dst, off_t ofs, block_sector_t from)
+{
+    struct inode_range range;
+    block_sector_t to;
+    bool done = false;
+
+    if (dst->deny_write_cnt || inode_is_meta(dst))
+    {
+        return false;
+    }
+
+    /* Sector already there, only this range is locked */
+    rwlock_acquire_read(&dst->rwlock);
+    if (inode_in_place(dst, ofs, BLOCK_SECTOR_SIZE))
+    {
+        range_acquire(dst, &range, ofs, ofs + BLOCK_SECTOR_SIZE, true);
+        cache_copy(from, byte_to_sector(dst, ofs));
+        range_release(dst, &range);
+        done = true;
+    }
+    rwlock_release_read(&dst->rwlock);
+
+    /* A hole, filling it changes the index blocks */
+    if (!done && is_indexed(&dst->data))
+    {
+        journal_begin();
+        rwlock_acquire_write(&dst->rwlock);
+        to = byte_to_sector(dst, ofs);
+        if (to == 0 && ofs + BLOCK_SECTOR_SIZE <= inode_length(dst))
+        {
+            to = inode_fill_hole(dst, ofs / BLOCK_SECTOR_SIZE);
+        }
+        if (to != 0 && to != -1u)
+        {
+            cache_copy(from, to);
+            done = true;
+        }
+        rwlock_release_write(&dst->rwlock);
+        journal_end();
+    }
+    return done;
+}
+
+/* Copies SIZE bytes of SRC starting at SRC_OFS into DST starting at
+ * DST_OFS, growing DST if needed, and returns the number of bytes
+ * copied.  Whole sectors at sector aligned offsets go cache slot to
+ * cache slot, the rest through a one sector buffer.  Copies nothing
+ * if DST would grow past the largest offset, or if SRC and DST are
+ * the same file and the copy would overwrite source bytes before
+ * reading them. */
+off_t inode_copy_range(struct inode *src, off_t src_ofs, struct inode *dst, off_t dst_ofs, off_t size)
+{
+    uint8_t *bounce;
+    off_t copied = 0;
+
+    if (src_ofs < 0 || dst_ofs < 0 || size <= 0 || src_ofs >= inode_length(src))
+    {
+        return 0;
+    }
+    if (size > inode_length(src) - src_ofs)
+    {
+        size = inode_length(src) - src_ofs;
+    }
+    if (dst_ofs > INT32_MAX - size)
+    {
+        return 0;
+    }
+    /* Going forward is only safe if DST stays behind SRC */
+    if (src == dst && dst_ofs > src_ofs && dst_ofs < src_ofs + size)
+    {
+        return 0;
+    }
+    bounce = malloc(BLOCK_SECTOR_SIZE);
+    if (bounce == NULL)
+    {
+        return 0;
+    }
+
+    /* Grow DST to its final length up front by writing the last byte,
+     * so the sectors in between can be copied into */
+    if (dst_ofs + size > inode_length(dst))
+    {
+        if (inode_read_at(src, bounce, 1, src_ofs + size - 1) != 1 || inode_write_at(dst, bounce, 1, dst_ofs + size - 1) != 1)
+        {
+            free(bounce);
+            return 0;
+        }
+    }
+
+    while (copied < size)
+    {
+        off_t chunk = size - copied;
+        block_sector_t from = 0;
+
+        /* Sector aligned on both sides, try the direct copy */
+        if (src != dst && src_ofs % BLOCK_SECTOR_SIZE == 0 && dst_ofs % BLOCK_SECTOR_SIZE == 0 && chunk >= BLOCK_SECTOR_SIZE)
+        {
+            /* Sectors never move once allocated, so FROM stays good */
+            rwlock_acquire_read(&src->rwlock);
+            from = byte_to_sector(src, src_ofs);
+            rwlock_release_read(&src->rwlock);
+        }
+        if (from != 0 && from != -1u && inode_copy_sector(dst, dst_ofs, from))
+        {
+            chunk = BLOCK_SECTOR_SIZE;
+        }
+        else
+        {
+            /* Up to the end of the source sector */
+            off_t sector_left = BLOCK_SECTOR_SIZE - src_ofs % BLOCK_SECTOR_SIZE;
+            off_t got;
+            chunk = chunk < sector_left ? chunk : sector_left;
+            got = inode_read_at(src, bounce, chunk, src_ofs);
+            chunk = got > 0 ? inode_write_at(dst, bounce, got, dst_ofs) : 0;
+            if (chunk <= 0)
+            {
+                break;
+            }
+        }
+
+        src_ofs += chunk;
+        dst_ofs += chunk;
+        copied += chunk;
+    }
+    free(bounce);
+    return copied;
+}
+
+/* Disables writes to INODE.
+ * May be called at most once per inode opener. */
+void inode_deny_write(struct inode *inode)
+{
+    lock_acquire(&open_inodes_lock);
+    inode->deny_write_cnt++;
+    ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+    lock_release(&open_inodes_lock);
+}
+
+/* Re-enables writes to INODE.
+ * Must be called once by each inode opener who has called
+ * inode_deny_write() on the inode, before closing the inode. */
 void inode_allow_write(struct inode *inode)
 {
+    lock_acquire(&open_inodes_lock);
     ASSERT(inode->deny_write_cnt > 0);
     ASSERT(inode->deny_write_cnt <= inode->open_cnt);
     inode->deny_write_cnt--;
+    lock_release(&open_inodes_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -424,6 +1169,23 @@ off_t inode_length(const struct inode *inode)
     return inode->data.length;
 }
 
+/* Fills *ST from INODE's on-disk inode.  For indexed files the block
+ * count skips holes, so it reads every index block of the file. */
+void inode_stat(struct inode *inode, struct stat *st)
+{
+    rwlock_acquire_read(&inode->rwlock);
+    st->st_ino = inode->sector;
+    st->st_isdir = inode->data.isDir;
+    st->st_size = inode->data.length;
+    if (inode->data.layout == INODE_LAYOUT_EXTENT)
+        st->st_blocks = inode->data.extent_sectors;
+    else if (inode->data.layout == INODE_LAYOUT_INLINE)
+        st->st_blocks = 0;
+    else
+        st->st_blocks = inode_mapped_sectors(&inode->data);
+    rwlock_release_read(&inode->rwlock);
+}
+
 /*
 Given an inode, it return the parent sector of an inode. ie like the parent directory
 */
@@ -449,142 +1211,236 @@ bool set_inode_parent(block_sector_t parent, block_sector_t child)
 /* & ADDED */
 
 /*
-Given a pointer to an inode_disk, it allocates some blocks for it
+Given a pointer to an inode_disk, it allocates some blocks for it,
+starting the search at GOAL (the inode's own sector)
 */
-static bool inode_alloc(struct inode_disk *inode_disk)
+static bool inode_alloc(struct inode_disk *inode_disk, block_sector_t goal)
 {
 
     log(L_TRACE, "inode_alloc(inode_disk: [%08x])", inode_disk);
-    return inode_save(inode_disk, inode_disk->length);
+    if (!inode_save(inode_disk, inode_disk->length, goal))
+    {
+        return false;
+    }
+    /* Extent growth stops short if the journal operation ran low */
+    return inode_disk->layout != INODE_LAYOUT_EXTENT || inode_disk->extent_sectors >= bytes_to_sectors(inode_disk->length);
 }
 
 /*
-Given a pointer to an inode_disk, it allocates some blocks for it
+Fills in the entries of TABLE[0..CNT) that are still 0 with zeroed sectors.
+Missing entries in a row are allocated as one run as close to *GOAL as
+possible, and *GOAL is moved past every sector TABLE maps, so the next
+allocation lands right after this one
 */
-bool inode_save_indirect(block_sector_t *blk_ptr, size_t num_sectors, int lvl)
+static bool alloc_blocks(block_sector_t *table, size_t cnt, block_sector_t *goal)
 {
-    log(L_TRACE, "inode_save_indirect(blk_ptr: [%08x], num_sectors: [%d], level: [%d] )", blk_ptr, num_sectors, lvl);
-    static char zero[BLOCK_SECTOR_SIZE]; /* NEED in bytes */
-
-    ASSERT(lvl <= 2);
+    static char zero[BLOCK_SECTOR_SIZE];
+    size_t i = 0;
 
-    if (lvl == 0)
+    while (i < cnt)
     {
-        if (*blk_ptr == 0)
+        block_sector_t start;
+        size_t want, got, k;
+
+        if (table[i] != 0)
         {
-            if (!free_map_allocate(1, blk_ptr))
-            {
-                return false;
-            }
-            /* Write everything to the disk */
-            block_write(fs_device, *blk_ptr, zero);
+            *goal = table[i] + 1;
+            i++;
+            continue;
         }
-        return true;
+        for (want = 1; i + want < cnt && table[i + want] == 0; want++)
+            continue;
+        if (!free_map_allocate_near(*goal, want, &start, &got))
+        {
+            return false;
+        }
+        for (k = 0; k < got; k++)
+        {
+            table[i + k] = start + k;
+            cache_write(start + k, zero);
+        }
+        i += got;
+        *goal = start + got;
     }
-    struct indirect_block indirect_block;
-    if (*blk_ptr == 0)
+    return true;
+}
+
+/*
+Gives block INDEX of an indexed inode, which must be a hole, a zeroed
+sector, allocating any index block missing on the way as well.
+Everything goes as close as possible after the block before it.
+Returns the new sector, or 0 if the disk is full
+*/
+static block_sector_t inode_fill_hole(struct inode *inode, off_t index)
+{
+    log(L_TRACE, "inode_fill_hole(inode: [%08x], index: [%d])", inode, index);
+    struct inode_disk *inode_disk = &inode->data;
+    struct indirect_block *indirect_block;
+    block_sector_t goal = inode->sector + 1;
+    block_sector_t parent, *top;
+    size_t path[4];
+    int i, lvl;
+
+    ASSERT(is_indexed(inode_disk));
+
+    if (index > 0)
     {
-        free_map_allocate(1, blk_ptr);
-        /* Write everything to the disk */
-        block_write(fs_device, *blk_ptr, zero);
+        block_sector_t prev = idx_sect(inode, index - 1);
+        if (prev != 0 && prev != -1u)
+        {
+            goal = prev + 1;
+        }
     }
-    /* Read from the disk */
-    block_read(fs_device, *blk_ptr, &indirect_block);
 
-    size_t num = (lvl == 1 ? 1 : NUMBER_INDIRECT_BLOCKS_PER_SECTOR);
-    size_t i, j = DIV_ROUND_UP(num_sectors, num);
+    /* Which pointer in the inode, and the path below it */
+    lvl = index_path(inode_disk, index, path);
+    if (lvl < 0)
+    {
+        log(L_ERROR, "File too big");
+        return 0;
+    }
+    top = &inode_disk->index_table[path[0]];
 
-    for (i = 0; i < j; ++i)
+    /* Direct Mappings */
+    if (lvl == 0)
     {
-        size_t sub = num_sectors < num ? num_sectors : num;
-        if (!inode_save_indirect(&indirect_block.blocks[i], sub, lvl - 1))
+        if (!alloc_blocks(top, 1, &goal))
         {
-            return false;
+            return 0;
         }
-        num_sectors -= sub;
+        inode_mark_dirty(inode);
+        return *top;
     }
-    ASSERT(num_sectors == 0);
-    /* Write back to the disk */
-    block_write(fs_device, *blk_ptr, &indirect_block);
-    return true;
-}
 
-static bool inode_save(struct inode_disk *inode_disk, off_t len)
-{
-    log(L_TRACE, "inode_save(disk_inode: [%08x], length: [%d )", inode_disk, len);
-    static char zero[BLOCK_SECTOR_SIZE];
-    if (len < 0)
+    indirect_block = malloc(sizeof *indirect_block);
+    if (indirect_block == NULL)
     {
-        log(L_ERROR, "Negative Length");
-        return false;
+        return 0;
     }
+    parent = 0;
+    if (*top == 0)
+    {
+        if (!alloc_blocks(top, 1, &goal))
+        {
+            goto done;
+        }
+        inode_mark_dirty(inode);
+    }
+    parent = *top;
 
-    size_t num_sectors = bytes_to_sectors(len);
-    size_t i;
-    log(L_INFO, "num_sectors[%d]", num_sectors);
-    /* Direct Mappings */
-    size_t j = num_sectors < NUMBER_DIRECT_BLOCKS ? num_sectors : NUMBER_DIRECT_BLOCKS;
-    for (i = 0; i < j; ++i)
+    /* Walk down, allocating what is missing */
+    for (i = 1; i <= lvl; i++)
     {
-        if (inode_disk->direct_map_table[i] == 0)
+        block_sector_t *child = &indirect_block->blocks[path[i]];
+        cache_read(parent, indirect_block);
+        if (*child == 0)
         {
-            if (!free_map_allocate(1, &inode_disk->direct_map_table[i]))
+            if (!alloc_blocks(child, 1, &goal))
             {
-                log(L_ERROR, "could not allocate");
-                return false;
+                parent = 0;
+                goto done;
             }
-            /* Write to the disk */
-            block_write(fs_device, inode_disk->direct_map_table[i], zero);
+            journal_write(parent, indirect_block);
         }
+        parent = *child;
     }
-    num_sectors -= j;
-    if (num_sectors == 0)
-    {
-        log(L_INFO, "Done, Direct Mapping");
-        return true;
-    }
 
-    /* Single Indirect Block*/
+done:
+    free(indirect_block);
+    /* The index blocks just changed, so the block map is stale */
+    map_invalidate(inode);
+    return parent;
+}
+
+/*
+Moves the bytes of an inline inode out to a data sector, switching it to
+the layout other new files get. The inode's rwlock must be held for writing
+*/
+static bool inode_migrate_inline(struct inode *inode)
+{
+    log(L_TRACE, "inode_migrate_inline(inode: [%08x])", inode);
+    struct inode_disk *inode_disk = &inode->data;
+    off_t length = inode_disk->length;
+    block_sector_t sector = 0;
+    uint8_t *data;
+
+    ASSERT(inode_disk->layout == INODE_LAYOUT_INLINE);
 
-    j = num_sectors < NUMBER_INDIRECT_BLOCKS_PER_SECTOR ? num_sectors : NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
-    if (!inode_save_indirect(&inode_disk->indirect_block_sec, j, 1))
+    data = calloc(1, BLOCK_SECTOR_SIZE);
+    if (data == NULL)
     {
-        log(L_ERROR, "could not allocate");
         return false;
     }
+    memcpy(data, inode_disk->inline_data, length);
+    memset(inode_disk->inline_data, 0, INODE_INLINE_SIZE);
+    inode_disk->layout = inode_use_extents ? INODE_LAYOUT_EXTENT : INODE_LAYOUT_TRIPLE;
 
-    num_sectors -= j;
-    if (num_sectors == 0)
+    if (length > 0)
     {
-        log(L_INFO, "Done, Single Indirect Block ");
-        return true;
-    }
+        if (inode_disk->layout == INODE_LAYOUT_EXTENT && inode_save(inode_disk, length, inode->sector))
+            sector = idx_sect(inode, 0);
+        else if (inode_disk->layout == INODE_LAYOUT_TRIPLE)
+            sector = inode_fill_hole(inode, 0);
 
-    /* Double Indirect Block */
-    j = num_sectors < NUMBER_BLOCKS_D_INDIRECT ? num_sectors : NUMBER_BLOCKS_D_INDIRECT;
+        if (sector == 0 || sector == -1u)
+        {
+            /* Put it back the way it was */
+            inode_dealloc(inode);
+            memset(inode_disk->inline_data, 0, INODE_INLINE_SIZE);
+            memcpy(inode_disk->inline_data, data, length);
+            inode_disk->layout = INODE_LAYOUT_INLINE;
+            map_invalidate(inode);
+            free(data);
+            return false;
+        }
+        cache_write(sector, data);
+    }
+    inode_mark_dirty(inode);
+    map_invalidate(inode);
+    free(data);
+    log(L_DEBUG, "Inline Migrated | Length: [%d] | Sector: [%d] ", length, sector);
+    return true;
+}
 
-    if (!inode_save_indirect(&inode_disk->double_indirect_block_sec, j, 2))
+/*
+Makes an inode map LEN bytes. Indexed inodes are sparse, blocks past the
+old end are holes until written, so only extent inodes allocate here,
+starting at GOAL. Fails if LEN is more than the layout can map
+*/
+static bool inode_save(struct inode_disk *inode_disk, off_t len, block_sector_t goal)
+{
+    log(L_TRACE, "inode_save(disk_inode: [%08x], length: [%d )", inode_disk, len);
+    if (len < 0)
     {
-        log(L_ERROR, "could not allocate");
+        log(L_ERROR, "Negative Length");
         return false;
     }
-    num_sectors -= j;
-    if (num_sectors == 0)
+    if (inode_disk->layout == INODE_LAYOUT_EXTENT)
     {
-        log(L_INFO, "Done, Double Indirect Block ");
-        return true;
+        return extent_save(inode_disk, len, goal);
     }
-
-    ASSERT(num_sectors == 0);
-    log(L_ERROR, "IT went fully poopy");
-    return false;
+    if (inode_disk->layout == INODE_LAYOUT_INLINE)
+    {
+        return len <= INODE_INLINE_SIZE;
+    }
+    if (bytes_to_sectors(len) > index_max_sectors(inode_disk))
+    {
+        log(L_ERROR, "File too big for its layout");
+        return false;
+    }
+    return true;
 }
 
 static void inode_dealloc_indirect(block_sector_t blk_sector, size_t num_sectors, int lvl)
 {
     log(L_TRACE, "inode_dealloc_indirect(blk_sector: [%d], num_sectors: [%d], level: [%d] )", blk_sector, num_sectors, lvl);
-    /* Check that it less than two lvls, we only do up to two lvls*/
-    ASSERT(lvl <= 2);
+    /* Check that it less than three lvls, we only do up to three lvls*/
+    ASSERT(lvl <= 3);
+    /* Hole, nothing was ever allocated below here */
+    if (blk_sector == 0)
+    {
+        return;
+    }
     if (lvl == 0)
     {
         free_map_release(blk_sector, 1);
@@ -593,10 +1449,14 @@ static void inode_dealloc_indirect(block_sector_t blk_sector, size_t num_sectors
 
     struct indirect_block indirect_block;
     /* Read from the disk */
-    block_read(fs_device, blk_sector, &indirect_block);
+    cache_read(blk_sector, &indirect_block);
 
-    size_t num = (lvl == 1 ? 1 : NUMBER_INDIRECT_BLOCKS_PER_SECTOR);
-    size_t i, j = DIV_ROUND_UP(num_sectors, num);
+    /* Sectors below each child */
+    size_t num = 1;
+    size_t i, j;
+    for (i = 1; i < (size_t)lvl; i++)
+        num *= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+    j = DIV_ROUND_UP(num_sectors, num);
 
     for (i = 0; i < j; ++i)
     {
@@ -609,6 +1469,76 @@ static void inode_dealloc_indirect(block_sector_t blk_sector, size_t num_sectors
     free_map_release(blk_sector, 1);
 }
 
+/*
+Returns how many data sectors are mapped below the index block in BLK_SECTOR,
+which covers NUM_SECTORS sectors of the file LVL levels down
+*/
+static size_t inode_count_indirect(block_sector_t blk_sector, size_t num_sectors, int lvl)
+{
+    ASSERT(lvl <= 3);
+    /* Hole, nothing was ever allocated below here */
+    if (blk_sector == 0)
+    {
+        return 0;
+    }
+    if (lvl == 0)
+    {
+        return 1;
+    }
+
+    struct indirect_block indirect_block;
+    cache_read(blk_sector, &indirect_block);
+
+    /* Sectors below each child */
+    size_t num = 1;
+    size_t cnt = 0;
+    size_t i, j;
+    for (i = 1; i < (size_t)lvl; i++)
+        num *= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+    j = DIV_ROUND_UP(num_sectors, num);
+
+    for (i = 0; i < j; ++i)
+    {
+        size_t sub = num_sectors < num ? num_sectors : num;
+        cnt += inode_count_indirect(indirect_block.blocks[i], sub, lvl - 1);
+        num_sectors -= sub;
+    }
+    return cnt;
+}
+
+/*
+Returns how many data sectors of an indexed inode are allocated, holes
+and index blocks not counted
+*/
+static size_t inode_mapped_sectors(const struct inode_disk *inode_disk)
+{
+    size_t num_sectors = bytes_to_sectors(inode_disk->length);
+    size_t direct_cnt = index_direct_cnt(inode_disk);
+    size_t span = 1;
+    size_t cnt = 0;
+    size_t i, j;
+    int lvl;
+
+    j = num_sectors < direct_cnt ? num_sectors : direct_cnt;
+    for (i = 0; i < j; ++i)
+    {
+        if (inode_disk->index_table[i] != 0)
+        {
+            cnt++;
+        }
+    }
+    num_sectors -= j;
+
+    for (lvl = 1; num_sectors > 0 && lvl <= index_levels(inode_disk); lvl++)
+    {
+        span *= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+        j = num_sectors < span ? num_sectors : span;
+        cnt += inode_count_indirect(inode_disk->index_table[direct_cnt + lvl - 1], j, lvl);
+        num_sectors -= j;
+    }
+    return cnt;
+}
+
 static bool inode_dealloc(struct inode *inode)
 {
     log(L_TRACE, "inode_dealloc(inode: [%08x])", inode);
@@ -617,33 +1547,279 @@ static bool inode_dealloc(struct inode *inode)
     {
         return false;
     }
+    if (inode->data.layout == INODE_LAYOUT_EXTENT)
+    {
+        extent_dealloc(&inode->data);
+        return true;
+    }
+    if (inode->data.layout == INODE_LAYOUT_INLINE)
+    {
+        /* No blocks */
+        return true;
+    }
     size_t num_sectors = bytes_to_sectors(file_length);
+    size_t direct_cnt = index_direct_cnt(&inode->data);
+    size_t span = 1;
     size_t i, j;
+    int lvl;
 
     /* Direct Mapping */
-    j = num_sectors < NUMBER_DIRECT_BLOCKS ? num_sectors : NUMBER_DIRECT_BLOCKS;
+    j = num_sectors < direct_cnt ? num_sectors : direct_cnt;
     for (i = 0; i < j; ++i)
     {
-        free_map_release(inode->data.direct_map_table[i], 1);
+        if (inode->data.index_table[i] != 0)
+        {
+            free_map_release(inode->data.index_table[i], 1);
+        }
     }
     num_sectors -= j;
 
-    /* Single Indirect Block */
-    j = num_sectors < NUMBER_INDIRECT_BLOCKS_PER_SECTOR ? num_sectors : NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
-    if (j > 0)
+    /* Single, Double (and Triple) Indirect Blocks */
+    for (lvl = 1; num_sectors > 0 && lvl <= index_levels(&inode->data); lvl++)
     {
-        inode_dealloc_indirect(inode->data.indirect_block_sec, j, 1);
+        span *= NUMBER_INDIRECT_BLOCKS_PER_SECTOR;
+        j = num_sectors < span ? num_sectors : span;
+        inode_dealloc_indirect(inode->data.index_table[direct_cnt + lvl - 1], j, lvl);
         num_sectors -= j;
     }
 
-    /* Double Indirect Block */
-    j = num_sectors < (NUMBER_BLOCKS_D_INDIRECT) ? num_sectors : (NUMBER_BLOCKS_D_INDIRECT);
-    if (j > 0)
+    ASSERT(num_sectors == 0);
+    return true;
+}
+
+/*
+Adds the run of CNT sectors at START to the end of an extent inode,
+growing the last extent when the run continues it.
+Returns false if the overflow tree is full or its blocks can't be allocated
+*/
+static bool extent_append(struct inode_disk *inode_disk, block_sector_t start, size_t cnt)
+{
+    size_t n = inode_disk->extent_cnt;
+    struct extent_index *extent_index = NULL;
+    struct extent_leaf *leaf = NULL;
+    bool new_index = false;
+    bool success = false;
+    size_t ovf, leaf_idx, slot;
+
+    /* Grow the last extent in the inode */
+    if (n > 0 && n <= NUMBER_INODE_EXTENTS)
     {
-        inode_dealloc_indirect(inode->data.double_indirect_block_sec, j, 2);
-        num_sectors -= j;
+        struct inode_extent *last = &inode_disk->extents[n - 1];
+        if (last->start + last->length == start)
+        {
+            last->length += cnt;
+            inode_disk->extent_sectors += cnt;
+            return true;
+        }
     }
 
-    ASSERT(num_sectors == 0);
+    /* New extent in the inode */
+    if (n < NUMBER_INODE_EXTENTS)
+    {
+        inode_disk->extents[n].start = start;
+        inode_disk->extents[n].length = cnt;
+        inode_disk->extent_cnt++;
+        inode_disk->extent_sectors += cnt;
+        return true;
+    }
+
+    extent_index = malloc(sizeof *extent_index);
+    leaf = malloc(sizeof *leaf);
+    if (extent_index == NULL || leaf == NULL)
+    {
+        goto done;
+    }
+    if (inode_disk->extent_index_sec == 0)
+    {
+        if (!free_map_allocate(1, &inode_disk->extent_index_sec))
+        {
+            goto done;
+        }
+        new_index = true;
+        memset(extent_index, 0, sizeof *extent_index);
+    }
+    else
+    {
+        cache_read(inode_disk->extent_index_sec, extent_index);
+    }
+
+    /* Grow the last extent in the overflow tree */
+    if (n > NUMBER_INODE_EXTENTS)
+    {
+        ovf = n - 1 - NUMBER_INODE_EXTENTS;
+        leaf_idx = ovf / NUMBER_LEAF_EXTENTS;
+        slot = ovf % NUMBER_LEAF_EXTENTS;
+        cache_read(extent_index->leaves[leaf_idx].sector, leaf);
+        if (leaf->extents[slot].start + leaf->extents[slot].length == start)
+        {
+            leaf->extents[slot].length += cnt;
+            journal_write(extent_index->leaves[leaf_idx].sector, leaf);
+            inode_disk->extent_sectors += cnt;
+            success = true;
+            goto done;
+        }
+    }
+
+    /* New extent in the overflow tree, starting a new leaf if the last one is full */
+    ovf = n - NUMBER_INODE_EXTENTS;
+    leaf_idx = ovf / NUMBER_LEAF_EXTENTS;
+    slot = ovf % NUMBER_LEAF_EXTENTS;
+    if (leaf_idx >= NUMBER_EXTENT_LEAVES)
+    {
+        log(L_ERROR, "Extent tree is full");
+        goto done;
+    }
+    if (slot == 0)
+    {
+        if (!free_map_allocate(1, &extent_index->leaves[leaf_idx].sector))
+        {
+            goto done;
+        }
+        extent_index->leaves[leaf_idx].first_index = inode_disk->extent_sectors;
+        journal_write(inode_disk->extent_index_sec, extent_index);
+        memset(leaf, 0, sizeof *leaf);
+    }
+    else
+    {
+        cache_read(extent_index->leaves[leaf_idx].sector, leaf);
+    }
+    leaf->extents[slot].start = start;
+    leaf->extents[slot].length = cnt;
+    leaf->extent_cnt = slot + 1;
+    journal_write(extent_index->leaves[leaf_idx].sector, leaf);
+    inode_disk->extent_cnt++;
+    inode_disk->extent_sectors += cnt;
+    success = true;
+
+done:
+    if (!success && new_index)
+    {
+        free_map_release(inode_disk->extent_index_sec, 1);
+        inode_disk->extent_index_sec = 0;
+    }
+    free(extent_index);
+    free(leaf);
+    return success;
+}
+
+/*
+Returns the sector just past the last extent of an extent inode,
+or 0 if it has no extents yet
+*/
+static block_sector_t extent_end(struct inode_disk *inode_disk)
+{
+    size_t n = inode_disk->extent_cnt;
+    struct extent_index *extent_index;
+    struct extent_leaf *leaf;
+    block_sector_t end = 0;
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (n <= NUMBER_INODE_EXTENTS)
+    {
+        return inode_disk->extents[n - 1].start + inode_disk->extents[n - 1].length;
+    }
+
+    extent_index = malloc(sizeof *extent_index);
+    leaf = malloc(sizeof *leaf);
+    if (extent_index != NULL && leaf != NULL)
+    {
+        size_t ovf = n - 1 - NUMBER_INODE_EXTENTS;
+        size_t slot = ovf % NUMBER_LEAF_EXTENTS;
+        cache_read(inode_disk->extent_index_sec, extent_index);
+        cache_read(extent_index->leaves[ovf / NUMBER_LEAF_EXTENTS].sector, leaf);
+        end = leaf->extents[slot].start + leaf->extents[slot].length;
+    }
+    free(extent_index);
+    free(leaf);
+    return end;
+}
+
+/*
+Allocates sectors for an extent inode until it maps LEN bytes.
+Each round asks the free map for the whole remainder as one run right
+after the last extent (or near GOAL for the first one), and takes the
+longest run it can get there, so files stay in as few extents as possible.
+Stops short, still returning true, once the running journal operation
+has no room for another extent
+*/
+static bool extent_save(struct inode_disk *inode_disk, off_t len, block_sector_t goal)
+{
+    log(L_TRACE, "extent_save(disk_inode: [%08x], length: [%d] )", inode_disk, len);
+    static char zero[BLOCK_SECTOR_SIZE];
+    size_t num_sectors = bytes_to_sectors(len);
+
+    if (inode_disk->extent_cnt > 0)
+    {
+        goal = extent_end(inode_disk);
+    }
+    while (inode_disk->extent_sectors < num_sectors && journal_has_room(EXTENT_LOG_MAX))
+    {
+        size_t cnt = num_sectors - inode_disk->extent_sectors;
+        block_sector_t start;
+        size_t i;
+
+        if (!free_map_allocate_near(goal, cnt, &start, &cnt))
+        {
+            log(L_ERROR, "could not allocate");
+            return false;
+        }
+        goal = start + cnt;
+        for (i = 0; i < cnt; i++)
+        {
+            cache_write(start + i, zero);
+        }
+        if (!extent_append(inode_disk, start, cnt))
+        {
+            free_map_release(start, cnt);
+            return false;
+        }
+        log(L_DEBUG, "Extent | Start: [%d] | Length: [%d] ", start, cnt);
+    }
     return true;
-}
\ No newline at end of file
+}
+
+/*
+Releases every sector of an extent inode, including the overflow tree
+*/
+static void extent_dealloc(struct inode_disk *inode_disk)
+{
+    log(L_TRACE, "extent_dealloc(disk_inode: [%08x])", inode_disk);
+    size_t i, j, leaf_cnt;
+    size_t cnt = inode_disk->extent_cnt < NUMBER_INODE_EXTENTS ? inode_disk->extent_cnt : NUMBER_INODE_EXTENTS;
+
+    for (i = 0; i < cnt; i++)
+    {
+        free_map_release(inode_disk->extents[i].start, inode_disk->extents[i].length);
+    }
+    if (inode_disk->extent_index_sec == 0)
+    {
+        return;
+    }
+
+    struct extent_index *extent_index = malloc(sizeof *extent_index);
+    struct extent_leaf *leaf = malloc(sizeof *leaf);
+    if (extent_index == NULL || leaf == NULL)
+    {
+        log(L_ERROR, "could not free the extent tree");
+        free(extent_index);
+        free(leaf);
+        return;
+    }
+    cache_read(inode_disk->extent_index_sec, extent_index);
+    leaf_cnt = DIV_ROUND_UP(inode_disk->extent_cnt - NUMBER_INODE_EXTENTS, NUMBER_LEAF_EXTENTS);
+    for (i = 0; i < leaf_cnt; i++)
+    {
+        cache_read(extent_index->leaves[i].sector, leaf);
+        for (j = 0; j < leaf->extent_cnt; j++)
+        {
+            free_map_release(leaf->extents[j].start, leaf->extents[j].length);
+        }
+        free_map_release(extent_index->leaves[i].sector, 1);
+    }
+    free_map_release(inode_disk->extent_index_sec, 1);
+    free(extent_index);
+    free(leaf);
+}
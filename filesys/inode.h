@@ -1,7 +1,7 @@
 #ifndef FILESYS_INODE_H
 #define FILESYS_INODE_H
 
-#include <list.h>
+#include <hash.h>
 #include <stdbool.h>
 
 #include "devices/block.h"
@@ -12,7 +12,33 @@
 #define NUMBER_INDIRECT_BLOCKS_PER_SECTOR 128
 #define NUMBER_BLOCKS_D_INDIRECT 16384
 
+/* Triple layout: one direct block gives way to a triple indirect block, for files up to ~1 GB */
+#define NUMBER_TRIPLE_DIRECT_BLOCKS 122
+#define NUMBER_BLOCKS_T_INDIRECT 2097152
+
+/* Extent layout: extents kept in the inode itself, and in each leaf of the overflow tree */
+#define NUMBER_INODE_EXTENTS 61
+#define NUMBER_LEAF_EXTENTS 63
+#define NUMBER_EXTENT_LEAVES 64
+
+/* Values for inode_disk.layout, how the data sectors of a file are mapped */
+#define INODE_LAYOUT_INDEXED 0 /* Direct, indirect and double indirect blocks. */
+#define INODE_LAYOUT_EXTENT 1  /* (start, length) runs of contiguous sectors. */
+#define INODE_LAYOUT_INLINE 2  /* Data stored in the inode itself. */
+#define INODE_LAYOUT_TRIPLE 3  /* Direct, indirect, double and triple indirect blocks. */
+
+/* Most bytes an inline file can hold, the size of the layout union */
+#define INODE_INLINE_SIZE 500
+
+/* A run of LENGTH contiguous sectors starting at START */
+struct inode_extent
+{
+    block_sector_t start;  /* First sector of the run. */
+    block_sector_t length; /* Number of sectors in the run. */
+};
+
 struct bitmap;
+struct stat;
 /* On-disk inode.
  * Must be exactly BLOCK_SECTOR_SIZE (512 Bytes) bytes long.
  & FOR A MAX OF 8MB file need 16384 sectors
@@ -26,48 +52,130 @@ struct inode_disk
 
     off_t length;      /* File size in bytes. (4 Bytes) */
     unsigned magic;    /* Magic number.(4 Bytes) */
-    uint8_t unused[3]; /* Not used. (Each Number is 1 byte)*/
+    uint8_t layout;    /* INODE_LAYOUT_INDEXED, _EXTENT, _INLINE or _TRIPLE (1 Byte) */
+    uint8_t unused[2]; /* Not used. (Each Number is 1 byte)*/
 
     /* Subdirectories*/
     bool isDir; /* Flag to note if regular file (0) or directory (1) | (1 Byte) */
 
-    /* Extensible Files, from the the VIDEO */
-    block_sector_t direct_map_table[NUMBER_DIRECT_BLOCKS]; /* Direct Mappings of blocks, max 123 blocks/sectors (492 Bytes)*/
-    block_sector_t indirect_block_sec;                     /* Indirect mapping (4 Bytes) */
-    block_sector_t double_indirect_block_sec;              /* Double indirect mapping (4 Bytes) */
+    union
+    {
+        /* INODE_LAYOUT_INDEXED */
+        struct
+        {
+            /* Extensible Files, from the the VIDEO */
+            block_sector_t direct_map_table[NUMBER_DIRECT_BLOCKS]; /* Direct Mappings of blocks, max 123 blocks/sectors (492 Bytes)*/
+            block_sector_t indirect_block_sec;                     /* Indirect mapping (4 Bytes) */
+            block_sector_t double_indirect_block_sec;              /* Double indirect mapping (4 Bytes) */
+        };
+
+        /* INODE_LAYOUT_TRIPLE */
+        struct
+        {
+            block_sector_t t_direct_map_table[NUMBER_TRIPLE_DIRECT_BLOCKS]; /* Direct Mappings of blocks, max 122 blocks/sectors (488 Bytes) */
+            block_sector_t t_indirect_block_sec;                            /* Indirect mapping (4 Bytes) */
+            block_sector_t t_double_indirect_block_sec;                     /* Double indirect mapping (4 Bytes) */
+            block_sector_t triple_indirect_block_sec;                       /* Triple indirect mapping (4 Bytes) */
+        };
+
+        /* Either indexed layout: the direct blocks, then the single, double
+         * (and triple) indirect block pointers */
+        block_sector_t index_table[NUMBER_DIRECT_BLOCKS + 2];
+
+        /* INODE_LAYOUT_EXTENT */
+        struct
+        {
+            struct inode_extent extents[NUMBER_INODE_EXTENTS]; /* First extents of the file, in file order (488 Bytes) */
+            uint32_t extent_cnt;                               /* Number of extents, including the overflow tree (4 Bytes) */
+            block_sector_t extent_sectors;                     /* Number of sectors mapped by all extents (4 Bytes) */
+            block_sector_t extent_index_sec;                   /* Overflow tree index block, 0 if none (4 Bytes) */
+        };
+
+        /* INODE_LAYOUT_INLINE */
+        uint8_t inline_data[INODE_INLINE_SIZE]; /* File contents, zeros past LENGTH (500 Bytes) */
+    };
+};
+
+/* Leaf of the extent overflow tree, holds the extents after the ones in the inode */
+struct extent_leaf
+{
+    uint32_t extent_cnt;                              /* Number of extents used in this leaf. */
+    uint32_t unused;                                  /* Not used. */
+    struct inode_extent extents[NUMBER_LEAF_EXTENTS]; /* Extents, in file order. */
+};
+
+/* Root of the extent overflow tree, one entry per leaf in file order */
+struct extent_index
+{
+    struct
+    {
+        block_sector_t first_index; /* Index of the first file sector mapped by the leaf. */
+        block_sector_t sector;      /* Sector holding the leaf. */
+    } leaves[NUMBER_EXTENT_LEAVES];
+};
+
+/* Indirect Block, points to other sectors */
+struct indirect_block
+{
+    block_sector_t blocks[NUMBER_INDIRECT_BLOCKS_PER_SECTOR];
 };
 
 /* In-memory inode. */
 struct inode
 {
-    struct list_elem elem;        /* Element in inode list. */
+    struct hash_elem elem;        /* Element in open inode table. */
     block_sector_t sector;        /* Sector number of disk location. */
-    int open_cnt;                 /* Number of openers. */
+    int open_cnt;                 /* Number of openers, protected by the table lock. */
     bool removed;                 /* True if deleted, false otherwise. */
     int deny_write_cnt;           /* 0: writes ok, >0: deny writes. */
+    bool dirty;                   /* DATA changed since last written to disk? */
     struct inode_disk data;       /* Inode content. */
-    struct lock lock;             /* A lock to sync per file, instead of per */
+    struct rwlock rwlock;         /* Shared for I/O inside the file, exclusive to change its length or blocks. */
     block_sector_t parent_sector; /* the parent of this sector */
-};
+    struct rwlock dir_lock;       /* Directories: shared to look up entries, exclusive to change them. */
 
-/* Indirect Block, points to other sectors */
-struct indirect_block
-{
-    block_sector_t blocks[NUMBER_INDIRECT_BLOCKS_PER_SECTOR];
+    /* Byte-range locks held by I/O under the shared rwlock */
+    struct lock range_lock;       /* Protects RANGES. */
+    struct list ranges;           /* Held ranges, list of struct inode_range. */
+    struct condition range_freed; /* Signaled when a range is released. */
+
+    /* Block map, in-memory copies of the index blocks, loaded on first use */
+    struct lock map_lock;                      /* Protects the block map. */
+    struct indirect_block *map_indirect;       /* Single indirect block, or NULL. */
+    struct indirect_block *map_d_indirect;     /* Double indirect block, or NULL. */
+    struct indirect_block **map_d_indirect_l2; /* Second level blocks of the double indirect block, or NULL. */
+    struct extent_index *map_extent_index;     /* Extent tree index block, or NULL. */
+    struct extent_leaf **map_extent_leaves;    /* Extent tree leaves, or NULL. */
 };
 
+/* If false (default), new files use the indexed layout.
+ * If true, new regular files use the extent layout.
+ * Controlled by kernel command-line option "-extents". */
+extern bool inode_use_extents;
+
+/* If true, new regular files that fit in INODE_INLINE_SIZE bytes keep
+ * their data in the inode until they grow past it.
+ * Controlled by kernel command-line option "-inline". */
+extern bool inode_use_inline;
+
 void inode_init(void);
+void inode_flush(void);
+size_t inode_dirty_cnt(void);
 bool inode_create(block_sector_t, off_t, bool is_dir);
 struct inode *inode_open(block_sector_t);
 struct inode *inode_reopen(struct inode *);
 block_sector_t inode_get_inumber(const struct inode *);
+block_sector_t inode_sector_at(struct inode *, off_t pos);
 void inode_close(struct inode *);
 void inode_remove(struct inode *);
 off_t inode_read_at(struct inode *, void *, off_t size, off_t offset);
+void inode_readahead(struct inode *, off_t start, off_t end);
 off_t inode_write_at(struct inode *, const void *, off_t size, off_t offset);
+off_t inode_copy_range(struct inode *src, off_t src_ofs, struct inode *dst, off_t dst_ofs, off_t size);
 void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(const struct inode *);
+void inode_stat(struct inode *, struct stat *);
 
 /* NEW FUNCTIONS*/
 block_sector_t get_inode_parent(const struct inode *inode);
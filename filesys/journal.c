@@ -0,0 +1,439 @@
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/thread.h"
+#define LOGGING_LEVEL 6
+#include <log.h>
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c /* "JRNL" */
+
+/* Journal header states. */
+#define JOURNAL_EMPTY 0     /* Nothing to replay. */
+#define JOURNAL_COMMITTED 1 /* Region holds a transaction that may not be home yet. */
+
+/* On-disk journal header, in sector JOURNAL_SECTOR.
+ * Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+{
+    unsigned magic;                       /* JOURNAL_MAGIC. */
+    uint32_t state;                       /* JOURNAL_EMPTY or JOURNAL_COMMITTED. */
+    block_sector_t start;                 /* First sector of the journal region. */
+    uint32_t cnt;                         /* Number of sectors logged. */
+    block_sector_t sectors[JOURNAL_SIZE]; /* Home sector of each logged sector. */
+};
+
+/* Metadata writes (inodes, index blocks, directories and the free
+ * map) are not written home directly.  Each sector changed since
+ * the last commit is listed in the running transaction and kept
+ * in the buffer cache, which must not write it back.  If the cache
+ * evicts one anyway, we keep a copy of it here.
+ *
+ * A commit waits until no operation is half done, then writes
+ * every listed sector to the journal region, then the header
+ * marked committed, then the sectors to their home locations, and
+ * finally clears the header.  After a crash, journal_init() redoes
+ * the home writes of a committed transaction, so each commit is
+ * all or nothing, and many operations share one commit. */
+static struct journal_header header;         /* Header, used by commits and replay. */
+static bool enabled;                         /* Does the disk have a journal? */
+static block_sector_t sectors[JOURNAL_SIZE]; /* Sectors in the running transaction. */
+static bool saved[JOURNAL_SIZE];             /* Is there a copy of the sector in COPIES? */
+static uint8_t *copies;                      /* Room for a copy of each sector. */
+static size_t running_cnt;                   /* Number of sectors in SECTORS. */
+static size_t active_cnt;                    /* Operations in progress. */
+static bool committing;                      /* Is a commit in progress? */
+static struct thread *committer;             /* Thread running the commit. */
+static struct lock journal_lock;             /* Protects all of the above. */
+static struct condition journal_cond;        /* An operation or a commit ended. */
+
+static void replay(void);
+static void write_transaction(void);
+
+/* Initializes the journal.  Unless FORMAT is true, reads the
+ * journal header and replays the last transaction if it was
+ * committed but maybe not written home.  Disks made without a
+ * journal work as before, without one. */
+void journal_init(bool format)
+{
+    ASSERT(sizeof header == BLOCK_SECTOR_SIZE);
+
+    lock_init(&journal_lock);
+    cond_init(&journal_cond);
+    /* Set aside up front, so the cache can always evict */
+    copies = palloc_get_multiple(PAL_ASSERT, DIV_ROUND_UP(JOURNAL_SIZE * BLOCK_SECTOR_SIZE, PGSIZE));
+    enabled = false;
+    running_cnt = 0;
+    active_cnt = 0;
+    committing = false;
+    committer = NULL;
+    if (format)
+    {
+        return;
+    }
+
+    block_read(fs_device, JOURNAL_SECTOR, &header);
+    if (header.magic != JOURNAL_MAGIC)
+    {
+        log(L_INFO, "no journal on this disk");
+        return;
+    }
+    enabled = true;
+    if (header.state == JOURNAL_COMMITTED)
+    {
+        replay();
+    }
+}
+
+/* Makes a journal on a disk being formatted. */
+void journal_create(void)
+{
+    block_sector_t start;
+
+    if (!free_map_allocate(JOURNAL_SIZE, &start))
+    {
+        PANIC("journal creation failed");
+    }
+    memset(&header, 0, sizeof header);
+    header.magic = JOURNAL_MAGIC;
+    header.state = JOURNAL_EMPTY;
+    header.start = start;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+    enabled = true;
+}
+
+/* Redoes the home writes of the transaction in the journal. */
+static void
+replay(void)
+{
+    static uint8_t buffer[BLOCK_SECTOR_SIZE];
+    size_t i;
+
+    if (header.cnt > JOURNAL_SIZE)
+    {
+        PANIC("corrupt journal header");
+    }
+    printf("Replaying journal (%u sectors)...", header.cnt);
+    for (i = 0; i < header.cnt; i++)
+    {
+        block_read(fs_device, header.start + i, buffer);
+        block_write(fs_device, header.sectors[i], buffer);
+    }
+    header.state = JOURNAL_EMPTY;
+    header.cnt = 0;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+    printf("done.\n");
+}
+
+/* Returns true if the running transaction has room for N
+ * operations, after setting aside room for the free map and the
+ * dirty inodes.
+ * The journal lock must be held. */
+static bool
+has_room(size_t n)
+{
+    return !enabled || running_cnt + n * JOURNAL_OP_SECTORS + free_map_sector_cnt() + inode_dirty_cnt() <= JOURNAL_SIZE;
+}
+
+/* Starts an operation.  Every metadata write of the operation up
+ * to the matching journal_end() lands in the same commit.  Calls
+ * nest, only the outermost one counts.  The outermost call may
+ * wait for a commit, so it must not be made while holding file
+ * system locks. */
+void journal_begin(void)
+{
+    struct thread *t = thread_current();
+
+    if (t->journal_depth++ > 0)
+    {
+        return;
+    }
+
+    lock_acquire(&journal_lock);
+    while (committing || !has_room(active_cnt + 1))
+    {
+        if (!committing && active_cnt == 0)
+        {
+            /* Nobody else will make room, commit ourselves. */
+            lock_release(&journal_lock);
+            t->journal_depth--;
+            journal_commit();
+            t->journal_depth++;
+            lock_acquire(&journal_lock);
+            continue;
+        }
+        cond_wait(&journal_cond, &journal_lock);
+    }
+    active_cnt++;
+    lock_release(&journal_lock);
+    t->journal_used = 0;
+}
+
+/* Ends an operation started with journal_begin(). */
+void journal_end(void)
+{
+    struct thread *t = thread_current();
+
+    ASSERT(t->journal_depth > 0);
+    if (--t->journal_depth > 0)
+    {
+        return;
+    }
+
+    lock_acquire(&journal_lock);
+    active_cnt--;
+    cond_broadcast(&journal_cond, &journal_lock);
+    lock_release(&journal_lock);
+}
+
+/* Returns true if the running thread is inside an operation. */
+bool journal_active(void)
+{
+    return thread_current()->journal_depth > 0;
+}
+
+/* Returns true if the running operation can log N more sectors
+ * within the room journal_begin() set aside for it.  Operations
+ * that can grow large check this and stop early, so that the rest
+ * goes into a new operation. */
+bool journal_has_room(size_t n)
+{
+    struct thread *t = thread_current();
+
+    return !enabled || t->journal_depth == 0 || t == committer || t->journal_used + n <= JOURNAL_OP_SECTORS;
+}
+
+/* Counts N sectors that the running operation will have logged at
+ * commit time, such as an inode it made dirty, against its room. */
+void journal_charge(size_t n)
+{
+    struct thread *t = thread_current();
+
+    if (t->journal_depth > 0)
+    {
+        t->journal_used += n;
+    }
+}
+
+/* Returns the index of SECTOR in the running transaction, or -1.
+ * The journal lock must be held. */
+static int
+find(block_sector_t sector)
+{
+    size_t i;
+
+    for (i = 0; i < running_cnt; i++)
+    {
+        if (sectors[i] == sector)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Adds SECTOR to the running transaction, counting it against the
+ * running operation's room. */
+static void
+add(block_sector_t sector)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    lock_acquire(&journal_lock);
+    if (find(sector) < 0)
+    {
+        /* journal_begin() only lets an operation in with room for it,
+         * so this means one went past its share.  Writing the sector
+         * without the journal would break the commit. */
+        if (running_cnt >= JOURNAL_SIZE)
+        {
+            PANIC("journal overflow at sector %u", sector);
+        }
+        sectors[running_cnt] = sector;
+        saved[running_cnt] = false;
+        running_cnt++;
+        thread_current()->journal_used++;
+    }
+    lock_release(&journal_lock);
+}
+
+/* Writes metadata sector SECTOR from BUFFER as part of the
+ * running transaction. */
+void journal_write(block_sector_t sector, const void *buffer)
+{
+    add(sector);
+    cache_write(sector, buffer);
+}
+
+/* Writes SIZE bytes from BUFFER into metadata sector SECTOR at
+ * byte OFS as part of the running transaction. */
+void journal_write_at(block_sector_t sector, const void *buffer, off_t ofs, off_t size)
+{
+    add(sector);
+    cache_write_at(sector, buffer, ofs, size);
+}
+
+/* Returns true if SECTOR was changed by the running transaction,
+ * so it must not be written home yet. */
+bool journal_pending(block_sector_t sector)
+{
+    bool pending;
+
+    if (!enabled)
+    {
+        return false;
+    }
+    lock_acquire(&journal_lock);
+    pending = find(sector) >= 0;
+    lock_release(&journal_lock);
+    return pending;
+}
+
+/* Keeps a copy of SECTOR, which the cache is evicting, if it was
+ * changed by the running transaction and so must not go home yet.
+ * Returns false if it is not pending, so the cache can write it
+ * home itself. */
+bool journal_save(block_sector_t sector, const void *data)
+{
+    bool pending = false;
+    int i;
+
+    if (!enabled)
+    {
+        return false;
+    }
+    lock_acquire(&journal_lock);
+    i = find(sector);
+    if (i >= 0)
+    {
+        memcpy(copies + i * BLOCK_SECTOR_SIZE, data, BLOCK_SECTOR_SIZE);
+        saved[i] = true;
+        pending = true;
+    }
+    lock_release(&journal_lock);
+    return pending;
+}
+
+/* If we kept a copy of SECTOR, copies it into DATA and returns
+ * true. */
+bool journal_lookup(block_sector_t sector, void *data)
+{
+    bool found = false;
+    int i;
+
+    if (!enabled)
+    {
+        return false;
+    }
+    lock_acquire(&journal_lock);
+    i = find(sector);
+    if (i >= 0 && saved[i])
+    {
+        memcpy(data, copies + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        found = true;
+    }
+    lock_release(&journal_lock);
+    return found;
+}
+
+/* Commits the running transaction.  Waits for the operations in
+ * progress to end and holds off new ones until done.  Dirty inodes
+ * and the free map are flushed first so they go into the same
+ * commit as the index blocks they point to. */
+void journal_commit(void)
+{
+    struct thread *t = thread_current();
+
+    ASSERT(t->journal_depth == 0);
+
+    lock_acquire(&journal_lock);
+    while (committing)
+    {
+        cond_wait(&journal_cond, &journal_lock);
+    }
+    committing = true;
+    while (active_cnt > 0)
+    {
+        cond_wait(&journal_cond, &journal_lock);
+    }
+    lock_release(&journal_lock);
+
+    /* Our own writes belong to this commit, the room for them was
+     * set aside by has_room(). */
+    committer = t;
+    t->journal_depth++;
+    inode_flush();
+    free_map_flush();
+    t->journal_depth--;
+
+    if (enabled)
+    {
+        write_transaction();
+    }
+
+    lock_acquire(&journal_lock);
+    committer = NULL;
+    committing = false;
+    cond_broadcast(&journal_cond, &journal_lock);
+    lock_release(&journal_lock);
+}
+
+/* Writes the running transaction to the journal, commits it and
+ * writes it home. */
+static void
+write_transaction(void)
+{
+    static uint8_t buffer[BLOCK_SECTOR_SIZE];
+    size_t cnt, i;
+
+    lock_acquire(&journal_lock);
+    cnt = running_cnt;
+    memcpy(header.sectors, sectors, cnt * sizeof *sectors);
+    lock_release(&journal_lock);
+    if (cnt == 0)
+    {
+        return;
+    }
+    log(L_DEBUG, "journal commit of [%d] sectors", cnt);
+
+    /* Log. */
+    for (i = 0; i < cnt; i++)
+    {
+        cache_read(header.sectors[i], buffer);
+        block_write(fs_device, header.start + i, buffer);
+    }
+    header.state = JOURNAL_COMMITTED;
+    header.cnt = cnt;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+
+    /* Write home. */
+    for (i = 0; i < cnt; i++)
+    {
+        cache_read(header.sectors[i], buffer);
+        block_write(fs_device, header.sectors[i], buffer);
+    }
+    header.state = JOURNAL_EMPTY;
+    header.cnt = 0;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+
+    /* Drop the committed sectors, keeping any added since. */
+    lock_acquire(&journal_lock);
+    running_cnt -= cnt;
+    memmove(sectors, sectors + cnt, running_cnt * sizeof *sectors);
+    memmove(saved, saved + cnt, running_cnt * sizeof *saved);
+    memmove(copies, copies + cnt * BLOCK_SECTOR_SIZE, running_cnt * BLOCK_SECTOR_SIZE);
+    lock_release(&journal_lock);
+}
@@ -0,0 +1,34 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Most sectors one transaction can log, one sector of the journal
+ * region each. */
+#define JOURNAL_SIZE 124
+
+/* Room set aside in the running transaction for each operation in
+ * progress. */
+#define JOURNAL_OP_SECTORS 32
+
+void journal_init(bool format);
+void journal_create(void);
+void journal_begin(void);
+void journal_end(void);
+bool journal_active(void);
+bool journal_has_room(size_t n);
+void journal_charge(size_t n);
+void journal_write(block_sector_t, const void *);
+void journal_write_at(block_sector_t, const void *, off_t ofs, off_t size);
+void journal_commit(void);
+
+/* For the buffer cache. */
+bool journal_pending(block_sector_t);
+bool journal_save(block_sector_t, const void *);
+bool journal_lookup(block_sector_t, void *);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,20 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+/* Directory entries returned many at a time by the getdents()
+ * system call, shared by the kernel and user programs. */
+
+#include <stdbool.h>
+
+/* Longest file name in a directory entry.  Same as the kernel's
+ * NAME_MAX and the user READDIR_MAX_LEN. */
+#define DIRENT_NAME_MAX 14
+
+/* One directory entry. */
+struct dirent {
+    unsigned d_ino;                       /* Inode number. */
+    bool     d_isdir;                     /* Is it a directory? */
+    char     d_name[DIRENT_NAME_MAX + 1]; /* Null terminated file name. */
+};
+
+#endif /* lib/dirent.h */
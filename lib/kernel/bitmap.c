@@ -2,6 +2,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "bitmap.h"
 #include "threads/malloc.h"
@@ -367,6 +368,22 @@ bitmap_write(const struct bitmap *b, struct file *file)
 
     return file_write_at(file, b->bits, size, 0) == size;
 }
+
+/* Copies SIZE bytes of B as bitmap_write() would store them,
+ * starting at byte OFS, into DST.  SIZE is cut short at the end of
+ * B.  Returns the number of bytes copied. */
+size_t
+bitmap_copy_part(const struct bitmap *b, void *dst, size_t ofs, size_t size)
+{
+    size_t file_size = byte_cnt(b->bit_cnt);
+
+    if (ofs >= file_size)
+        return 0;
+    if (size > file_size - ofs)
+        size = file_size - ofs;
+    memcpy(dst, (const char *) b->bits + ofs, size);
+    return size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,16 @@
+#ifndef __LIB_STAT_H
+#define __LIB_STAT_H
+
+/* File information returned by the stat() and fstat() system
+ * calls, shared by the kernel and user programs. */
+
+#include <stdbool.h>
+
+struct stat {
+    unsigned st_ino;    /* Inode number. */
+    bool     st_isdir;  /* Is it a directory? */
+    int      st_size;   /* Length in bytes. */
+    unsigned st_blocks; /* Data sectors allocated, holes not counted. */
+};
+
+#endif /* lib/stat.h */
@@ -27,7 +27,15 @@ enum {
     SYS_MKDIR,   /* Create a directory. */
     SYS_READDIR, /* Reads a directory entry. */
     SYS_ISDIR,   /* Tests if a fd represents a directory. */
-    SYS_INUMBER  /* Returns the inode number for a fd. */
+    SYS_INUMBER, /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_READV,     /* Read from a file into several buffers. */
+    SYS_WRITEV,    /* Write several buffers to a file. */
+    SYS_GETDENTS,  /* Reads many directory entries at once. */
+    SYS_STAT,      /* Obtain information about a named file. */
+    SYS_FSTAT,     /* Obtain information about a fd. */
+    SYS_COPY_RANGE /* Copy bytes from one file to another. */
 };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,18 @@
+#ifndef __LIB_UIO_H
+#define __LIB_UIO_H
+
+/* Scatter/gather I/O, shared by the kernel and user programs
+ * for the readv() and writev() system calls. */
+
+#include <stddef.h>
+
+/* One segment of a vectored read or write. */
+struct iovec {
+    void  *iov_base; /* Start of the segment. */
+    size_t iov_len;  /* Number of bytes in the segment. */
+};
+
+/* Most segments a single readv() or writev() accepts. */
+#define IOV_MAX 64
+
+#endif /* lib/uio.h */
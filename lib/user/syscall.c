@@ -61,6 +61,25 @@
         retval;                                          \
     })
 
+/* Invokes syscall NUMBER, passing arguments ARG0 through ARG4,
+ * and returns the return value as an `int'. */
+#define syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)                  \
+    ({                                                                  \
+        int retval;                                                     \
+        asm volatile                                                    \
+        ("pushl %[arg4]; pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; " \
+         "pushl %[arg0]; pushl %[number]; int $0x30; addl $24, %%esp"   \
+         : "=a" (retval)                                                \
+         : [number] "i" (NUMBER),                                       \
+         [arg0] "r" (ARG0),                                             \
+         [arg1] "r" (ARG1),                                             \
+         [arg2] "r" (ARG2),                                             \
+         [arg3] "r" (ARG3),                                             \
+         [arg4] "r" (ARG4)                                              \
+         : "memory");                                                   \
+        retval;                                                         \
+    })
+
 void
 halt(void)
 {
@@ -182,3 +201,40 @@ inumber(int fd)
 {
     return syscall1(SYS_INUMBER, fd);
 }
+
+int
+readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return syscall3(SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    return syscall3(SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+getdents(int fd, struct dirent *ents, unsigned size)
+{
+    return syscall3(SYS_GETDENTS, fd, ents, size);
+}
+
+bool
+stat(const char *file, struct stat *st)
+{
+    return syscall2(SYS_STAT, file, st);
+}
+
+bool
+fstat(int fd, struct stat *st)
+{
+    return syscall2(SYS_FSTAT, fd, st);
+}
+
+int
+copy_range(int src_fd, unsigned src_ofs, int dst_fd, unsigned dst_ofs,
+           unsigned length)
+{
+    return syscall5(SYS_COPY_RANGE, src_fd, src_ofs, dst_fd, dst_ofs, length);
+}
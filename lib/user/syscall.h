@@ -2,7 +2,10 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <debug.h>
+#include <dirent.h>
+#include <stat.h>
 #include <stdbool.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +48,13 @@ bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
 
+/* Extensions. */
+int readv(int fd, const struct iovec *iov, int iovcnt);
+int writev(int fd, const struct iovec *iov, int iovcnt);
+int getdents(int fd, struct dirent *ents, unsigned size);
+bool stat(const char *file, struct stat *st);
+bool fstat(int fd, struct stat *st);
+int copy_range(int src_fd, unsigned src_ofs, int dst_fd, unsigned dst_ofs,
+               unsigned length);
+
 #endif /* lib/user/syscall.h */
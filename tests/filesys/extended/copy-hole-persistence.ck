@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($src) = join ('', map (chr ($_ % 251), 0...1499));
+my ($dst) = "\0" x 10500;
+substr ($dst, 1024, 1024) = substr ($src, 0, 1024);
+substr ($dst, 10000, 500) = substr ($src, 1000, 500);
+check_archive ({"src" => [$src], "dst" => [$dst]});
+pass;
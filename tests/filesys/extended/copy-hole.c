@@ -0,0 +1,42 @@
+/* Copies whole sectors into a hole of a sparse file, then copies
+   a range to past its end, which must grow it with zeros in
+   between. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char src[1500];
+static char dst[10500];
+
+void
+test_main (void) 
+{
+  int src_fd, dst_fd;
+  char zero = 0;
+  size_t i;
+
+  for (i = 0; i < sizeof src; i++)
+    src[i] = i % 251;
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK ((src_fd = open ("src")) > 1, "open \"src\"");
+  CHECK (write (src_fd, src, sizeof src) == sizeof src, "write \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((dst_fd = open ("dst")) > 1, "open \"dst\"");
+  msg ("seek \"dst\"");
+  seek (dst_fd, 8191);
+  CHECK (write (dst_fd, &zero, 1) == 1, "write \"dst\"");
+
+  CHECK (copy_range (src_fd, 0, dst_fd, 1024, 1024) == 1024,
+         "copy 1024 bytes into a hole");
+  memcpy (dst + 1024, src, 1024);
+  CHECK (copy_range (src_fd, 1000, dst_fd, 10000, 500) == 500,
+         "copy 500 bytes past the end");
+  memcpy (dst + 10000, src + 1000, 500);
+  msg ("close \"src\"");
+  close (src_fd);
+  msg ("close \"dst\"");
+  close (dst_fd);
+  check_file ("dst", dst, sizeof dst);
+}
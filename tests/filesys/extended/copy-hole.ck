@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-hole) begin
+(copy-hole) create "src"
+(copy-hole) open "src"
+(copy-hole) write "src"
+(copy-hole) create "dst"
+(copy-hole) open "dst"
+(copy-hole) seek "dst"
+(copy-hole) write "dst"
+(copy-hole) copy 1024 bytes into a hole
+(copy-hole) copy 500 bytes past the end
+(copy-hole) close "src"
+(copy-hole) close "dst"
+(copy-hole) open "dst" for verification
+(copy-hole) verified contents of "dst"
+(copy-hole) close "dst"
+(copy-hole) end
+EOF
+pass;
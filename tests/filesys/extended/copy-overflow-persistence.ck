@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($src) = join ('', map (chr ($_ % 251), 0...511));
+check_archive ({"src" => [$src], "dst" => [""]});
+pass;
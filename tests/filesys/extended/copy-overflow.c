@@ -0,0 +1,33 @@
+/* Tries to copy to offsets where the end of the copy can't be
+   represented.  Nothing must be copied and the destination must
+   keep its size. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[512];
+
+void
+test_main (void) 
+{
+  int src_fd, dst_fd;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((src_fd = open ("src")) > 1, "open \"src\"");
+  CHECK (write (src_fd, buf, sizeof buf) == sizeof buf, "write \"src\"");
+  CHECK ((dst_fd = open ("dst")) > 1, "open \"dst\"");
+  CHECK (copy_range (src_fd, 0, dst_fd, 0x7fffff00, sizeof buf) == 0,
+         "copy 512 bytes to 0x7fffff00");
+  CHECK (copy_range (src_fd, 0, dst_fd, 0xfffffe00, sizeof buf) == 0,
+         "copy 512 bytes to 0xfffffe00");
+  CHECK (filesize (dst_fd) == 0, "\"dst\" is still empty");
+  msg ("close \"src\"");
+  close (src_fd);
+  msg ("close \"dst\"");
+  close (dst_fd);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-overflow) begin
+(copy-overflow) create "src"
+(copy-overflow) create "dst"
+(copy-overflow) open "src"
+(copy-overflow) write "src"
+(copy-overflow) open "dst"
+(copy-overflow) copy 512 bytes to 0x7fffff00
+(copy-overflow) copy 512 bytes to 0xfffffe00
+(copy-overflow) "dst" is still empty
+(copy-overflow) close "src"
+(copy-overflow) close "dst"
+(copy-overflow) end
+EOF
+pass;
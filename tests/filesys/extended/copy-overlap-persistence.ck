@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = join ('', map (chr ($_ % 251), 0...1999));
+substr ($data, 0, 1000) = substr ($data, 100, 1000);
+check_archive ({"data" => [$data]});
+pass;
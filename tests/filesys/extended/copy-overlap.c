@@ -0,0 +1,39 @@
+/* Copies a range of a file over itself, through two file
+   descriptors and through one.  A copy to a later offset that
+   overlaps its source must copy nothing, a copy to an earlier
+   offset must work. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 2000
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "data";
+  int fd_a, fd_b;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd_a = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd_a, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  CHECK ((fd_b = open (file_name)) > 1, "open \"%s\" again", file_name);
+  CHECK (copy_range (fd_a, 0, fd_b, 100, 1000) == 0,
+         "copy 1000 bytes from 0 to 100");
+  CHECK (copy_range (fd_a, 0, fd_a, 999, 1000) == 0,
+         "copy 1000 bytes from 0 to 999 through one fd");
+  CHECK (copy_range (fd_a, 100, fd_b, 0, 1000) == 1000,
+         "copy 1000 bytes from 100 to 0");
+  memmove (buf, buf + 100, 1000);
+  msg ("close \"%s\"", file_name);
+  close (fd_a);
+  close (fd_b);
+  check_file (file_name, buf, sizeof buf);
+}
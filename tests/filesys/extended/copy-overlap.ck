@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-overlap) begin
+(copy-overlap) create "data"
+(copy-overlap) open "data"
+(copy-overlap) write "data"
+(copy-overlap) open "data" again
+(copy-overlap) copy 1000 bytes from 0 to 100
+(copy-overlap) copy 1000 bytes from 0 to 999 through one fd
+(copy-overlap) copy 1000 bytes from 100 to 0
+(copy-overlap) close "data"
+(copy-overlap) open "data" for verification
+(copy-overlap) verified contents of "data"
+(copy-overlap) close "data"
+(copy-overlap) end
+EOF
+pass;
@@ -0,0 +1,33 @@
+/* Copies a range that runs past the end of the source, which
+   must copy only up to the end, then one that starts at the end,
+   which must copy nothing. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1000];
+
+void
+test_main (void) 
+{
+  int src_fd, dst_fd;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i % 251;
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK ((src_fd = open ("src")) > 1, "open \"src\"");
+  CHECK (write (src_fd, buf, sizeof buf) == sizeof buf, "write \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((dst_fd = open ("dst")) > 1, "open \"dst\"");
+  CHECK (copy_range (src_fd, 600, dst_fd, 0, 1000) == 400,
+         "copy 1000 bytes from offset 600");
+  CHECK (copy_range (src_fd, 1000, dst_fd, 400, 100) == 0,
+         "copy 100 bytes from offset 1000");
+  msg ("close \"src\"");
+  close (src_fd);
+  msg ("close \"dst\"");
+  close (dst_fd);
+  check_file ("dst", buf + 600, 400);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-short) begin
+(copy-short) create "src"
+(copy-short) open "src"
+(copy-short) write "src"
+(copy-short) create "dst"
+(copy-short) open "dst"
+(copy-short) copy 1000 bytes from offset 600
+(copy-short) copy 100 bytes from offset 1000
+(copy-short) close "src"
+(copy-short) close "dst"
+(copy-short) open "dst" for verification
+(copy-short) verified contents of "dst"
+(copy-short) close "dst"
+(copy-short) end
+EOF
+pass;
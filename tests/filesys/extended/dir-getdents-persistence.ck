@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($dir) = +{map (("f$_" => ['']), 0...9)};
+$dir->{'sub'} = {};
+check_archive ({"dir" => $dir});
+pass;
@@ -0,0 +1,85 @@
+/* Lists a directory with getdents(), a few entries at a time and
+   with a readdir() in between, since both move the same position.
+   Every entry must come back exactly once, with the right type.
+   A buffer too small for one entry is an error, not the end. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10
+
+/* Names seen so far, FILE_CNT files and then "sub". */
+static bool seen[FILE_CNT + 1];
+
+static void
+see (const char *name, bool isdir)
+{
+  int i;
+
+  for (i = 0; i <= FILE_CNT; i++)
+    {
+      char expected[16];
+
+      if (i < FILE_CNT)
+        snprintf (expected, sizeof expected, "f%d", i);
+      else
+        strlcpy (expected, "sub", sizeof expected);
+      if (strcmp (name, expected))
+        continue;
+      if (seen[i])
+        fail ("\"%s\" listed twice", name);
+      if (isdir != (i == FILE_CNT))
+        fail ("\"%s\" listed with the wrong type", name);
+      seen[i] = true;
+      return;
+    }
+  fail ("unexpected entry \"%s\"", name);
+}
+
+void
+test_main (void) 
+{
+  struct dirent ents[4];
+  char name[READDIR_MAX_LEN + 1];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  msg ("creating files");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      char file_name[16];
+
+      snprintf (file_name, sizeof file_name, "dir/f%d", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\"", file_name);
+    }
+  CHECK (mkdir ("dir/sub"), "mkdir \"dir/sub\"");
+  CHECK ((fd = open ("dir")) > 1, "open \"dir\"");
+
+  CHECK (getdents (fd, ents, sizeof *ents - 1) == -1,
+         "getdents with room for no entry");
+
+  CHECK ((cnt = getdents (fd, ents, 3 * sizeof *ents)) == 3,
+         "getdents with room for 3 entries");
+  for (i = 0; i < cnt; i++)
+    see (ents[i].d_name, ents[i].d_isdir);
+
+  CHECK (readdir (fd, name), "readdir");
+  see (name, !strcmp (name, "sub"));
+
+  CHECK ((cnt = getdents (fd, ents, sizeof ents)) == 4,
+         "getdents with room for 4 entries");
+  for (i = 0; i < cnt; i++)
+    see (ents[i].d_name, ents[i].d_isdir);
+  CHECK ((cnt = getdents (fd, ents, sizeof ents)) == 3,
+         "getdents the last 3 entries");
+  for (i = 0; i < cnt; i++)
+    see (ents[i].d_name, ents[i].d_isdir);
+  CHECK (getdents (fd, ents, sizeof ents) == 0, "getdents at the end");
+
+  msg ("close \"dir\"");
+  close (fd);
+}
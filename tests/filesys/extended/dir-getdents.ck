@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "dir"
+(dir-getdents) creating files
+(dir-getdents) mkdir "dir/sub"
+(dir-getdents) open "dir"
+(dir-getdents) getdents with room for no entry
+(dir-getdents) getdents with room for 3 entries
+(dir-getdents) readdir
+(dir-getdents) getdents with room for 4 entries
+(dir-getdents) getdents the last 3 entries
+(dir-getdents) getdents at the end
+(dir-getdents) close "dir"
+(dir-getdents) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"f" => ["\0" x 5119 . "x"], "d" => {}});
+pass;
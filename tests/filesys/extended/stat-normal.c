@@ -0,0 +1,44 @@
+/* Checks stat() and fstat() on a sparse regular file, on a
+   directory and on a path that does not exist. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct stat st;
+  char x = 'x';
+  int fd;
+
+  CHECK (create ("f", 0), "create \"f\"");
+  CHECK ((fd = open ("f")) > 1, "open \"f\"");
+  msg ("seek \"f\"");
+  seek (fd, 5119);
+  CHECK (write (fd, &x, 1) == 1, "write \"f\"");
+
+  CHECK (stat ("f", &st), "stat \"f\"");
+  if (st.st_isdir)
+    fail ("\"f\" is a directory");
+  if (st.st_size != 5120)
+    fail ("\"f\" is %d bytes long, expected 5120", st.st_size);
+  if (st.st_ino != (unsigned) inumber (fd))
+    fail ("\"f\" has inode %u, expected %d", st.st_ino, inumber (fd));
+  if (st.st_blocks < 1 || st.st_blocks > 10)
+    fail ("\"f\" has %u blocks, expected 1 to 10", st.st_blocks);
+
+  CHECK (fstat (fd, &st), "fstat \"f\"");
+  if (st.st_isdir || st.st_size != 5120
+      || st.st_ino != (unsigned) inumber (fd))
+    fail ("fstat disagrees with stat");
+  msg ("close \"f\"");
+  close (fd);
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (stat ("d", &st), "stat \"d\"");
+  if (!st.st_isdir)
+    fail ("\"d\" is not a directory");
+
+  CHECK (!stat ("missing", &st), "stat \"missing\" (must return false)");
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(stat-normal) begin
+(stat-normal) create "f"
+(stat-normal) open "f"
+(stat-normal) seek "f"
+(stat-normal) write "f"
+(stat-normal) stat "f"
+(stat-normal) fstat "f"
+(stat-normal) close "f"
+(stat-normal) mkdir "d"
+(stat-normal) stat "d"
+(stat-normal) stat "missing" (must return false)
+(stat-normal) end
+EOF
+pass;
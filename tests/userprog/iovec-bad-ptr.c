@@ -0,0 +1,20 @@
+/* Passes readv() a segment with an invalid base between two
+   valid ones.  The process must be terminated with -1 exit
+   code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[16];
+  struct iovec iov[3] = {{buf, 8}, {(char *) 0xc0100000, 123}, {buf + 8, 8}};
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  readv (handle, iov, 3);
+  fail ("should not have survived readv()");
+}
@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iovec-bad-ptr) begin
+(iovec-bad-ptr) open "sample.txt"
+iovec-bad-ptr: exit(-1)
+EOF
+pass;
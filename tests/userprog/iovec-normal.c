@@ -0,0 +1,33 @@
+/* Writes a file with writev() from three segments, then reads it
+   back with readv() into two segments split at a different point,
+   and checks that the data survived the trip. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char out[35] = "Amazing Electronic Fact: If you sc";
+static char in[sizeof out];
+
+void
+test_main (void) 
+{
+  struct iovec wv[3] = {{out, 5}, {out + 5, 10}, {out + 15, 20}};
+  struct iovec rv[2] = {{in, 17}, {in + 17, 18}};
+  int handle, byte_cnt;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+
+  byte_cnt = writev (handle, wv, 3);
+  if (byte_cnt != sizeof out)
+    fail ("writev() returned %d instead of %zu", byte_cnt, sizeof out);
+
+  seek (handle, 0);
+  byte_cnt = readv (handle, rv, 2);
+  if (byte_cnt != sizeof in)
+    fail ("readv() returned %d instead of %zu", byte_cnt, sizeof in);
+  if (memcmp (in, out, sizeof out))
+    fail ("readv() read back different data");
+}
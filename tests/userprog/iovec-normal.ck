@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iovec-normal) begin
+(iovec-normal) create "data"
+(iovec-normal) open "data"
+(iovec-normal) end
+iovec-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,30 @@
+/* Calls readv() and writev() with no segments, which should
+   return 0 without reading or writing anything. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf = 123;
+  struct iovec iov = {&buf, 1};
+  int handle, byte_cnt;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+
+  byte_cnt = readv (handle, &iov, 0);
+  if (byte_cnt != 0)
+    fail ("readv() returned %d instead of 0", byte_cnt);
+  else if (buf != 123)
+    fail ("readv() with no segments modified buffer");
+  else if (tell (handle) != 0)
+    fail ("readv() with no segments moved the file position");
+
+  byte_cnt = writev (handle, &iov, 0);
+  if (byte_cnt != 0)
+    fail ("writev() returned %d instead of 0", byte_cnt);
+  else if (filesize (handle) != 239)
+    fail ("writev() with no segments changed the file size");
+}
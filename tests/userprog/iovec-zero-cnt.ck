@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iovec-zero-cnt) begin
+(iovec-zero-cnt) open "sample.txt"
+(iovec-zero-cnt) end
+iovec-zero-cnt: exit(0)
+EOF
+pass;
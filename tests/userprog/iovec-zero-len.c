@@ -0,0 +1,33 @@
+/* Passes a zero-length segment, with a null base, between two
+   others to writev() and readv().  It must be skipped without
+   its base being looked at. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char out[] = "0123456789";
+static char in[10];
+
+void
+test_main (void) 
+{
+  struct iovec wv[3] = {{out, 4}, {NULL, 0}, {out + 4, 6}};
+  struct iovec rv[3] = {{in, 6}, {NULL, 0}, {in + 6, 4}};
+  int handle, byte_cnt;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+
+  byte_cnt = writev (handle, wv, 3);
+  if (byte_cnt != 10)
+    fail ("writev() returned %d instead of 10", byte_cnt);
+
+  seek (handle, 0);
+  byte_cnt = readv (handle, rv, 3);
+  if (byte_cnt != 10)
+    fail ("readv() returned %d instead of 10", byte_cnt);
+  if (memcmp (in, out, sizeof in))
+    fail ("readv() read back different data");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(iovec-zero-len) begin
+(iovec-zero-len) create "data"
+(iovec-zero-len) open "data"
+(iovec-zero-len) end
+iovec-zero-len: exit(0)
+EOF
+pass;
@@ -0,0 +1,13 @@
+/* Passes stat() an invalid pointer for the result.  The process
+   must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  stat ("sample.txt", (struct stat *) 0xc0100000);
+  fail ("should not have survived stat()");
+}
@@ -35,8 +35,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iosched.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -252,6 +254,15 @@ parse_options(char **argv)
             filesys_bdev_name = value;
         } else if (!strcmp(name, "-scratch")) {
             scratch_bdev_name = value;
+        } else if (!strcmp(name, "-extents")) {
+            inode_use_extents = true;
+        } else if (!strcmp(name, "-inline")) {
+            inode_use_inline = true;
+        } else if (!strcmp(name, "-iosched")) {
+            if (value == NULL || !iosched_select(value)) {
+                PANIC("unknown I/O scheduler `%s' (use clook or noop)",
+                      value != NULL ? value : "");
+            }
         }
 #ifdef VM
         else if (!strcmp(name, "-swap")) {
@@ -384,6 +395,9 @@ usage(void)
            "  -f                 Format file system device during startup.\n"
            "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
            "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+           "  -extents           Use extent-based inodes for new files.\n"
+           "  -inline            Store tiny files inside their inode.\n"
+           "  -iosched=NAME      Order disk requests with NAME (clook, noop).\n"
 #ifdef VM
            "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -336,3 +336,101 @@ cond_broadcast(struct condition *cond, struct lock *lock)
         cond_signal(cond, lock);
     }
 }
+
+/* Initializes RWLOCK.  A readers-writer lock can be held by any
+ * number of readers at once, or by a single writer. */
+void
+rwlock_init(struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+
+    lock_init(&rw->lock);
+    cond_init(&rw->can_read);
+    cond_init(&rw->can_write);
+    rw->readers = 0;
+    rw->waiting_writers = 0;
+    rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+ * is waiting for it.
+ *
+ * This function may sleep, so it must not be called within an
+ * interrupt handler. */
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+    ASSERT(!intr_context());
+
+    lock_acquire(&rw->lock);
+    while (rw->writer != NULL || rw->waiting_writers > 0) {
+        cond_wait(&rw->can_read, &rw->lock);
+    }
+    rw->readers++;
+    lock_release(&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read(struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+
+    lock_acquire(&rw->lock);
+    ASSERT(rw->readers > 0);
+    if (--rw->readers == 0) {
+        cond_signal(&rw->can_write, &rw->lock);
+    }
+    lock_release(&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or other
+ * writer holds it.
+ *
+ * This function may sleep, so it must not be called within an
+ * interrupt handler. */
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+    ASSERT(!intr_context());
+    ASSERT(!rwlock_held_for_write(rw));
+
+    lock_acquire(&rw->lock);
+    rw->waiting_writers++;
+    while (rw->writer != NULL || rw->readers > 0) {
+        cond_wait(&rw->can_write, &rw->lock);
+    }
+    rw->waiting_writers--;
+    rw->writer = thread_current();
+    lock_release(&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing.
+ * Another waiting writer goes first, otherwise all waiting
+ * readers are let in. */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+    ASSERT(rwlock_held_for_write(rw));
+
+    lock_acquire(&rw->lock);
+    rw->writer = NULL;
+    if (rw->waiting_writers > 0) {
+        cond_signal(&rw->can_write, &rw->lock);
+    } else {
+        cond_broadcast(&rw->can_read, &rw->lock);
+    }
+    lock_release(&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_held_for_write(const struct rwlock *rw)
+{
+    ASSERT(rw != NULL);
+
+    return rw->writer == thread_current();
+}
@@ -38,6 +38,24 @@ void cond_wait(struct condition *, struct lock *);
 void cond_signal(struct condition *, struct lock *);
 void cond_broadcast(struct condition *, struct lock *);
 
+/* Readers-writer lock.  Any number of readers, or one writer.
+ * Waiting writers keep new readers out so they do not starve. */
+struct rwlock {
+    struct lock      lock;            /* Protects the fields below. */
+    struct condition can_read;        /* Signaled when readers may enter. */
+    struct condition can_write;       /* Signaled when a writer may enter. */
+    unsigned         readers;         /* Number of readers inside. */
+    unsigned         waiting_writers; /* Number of writers waiting. */
+    struct thread   *writer;          /* Writer inside, or NULL. */
+};
+
+void rwlock_init(struct rwlock *);
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_held_for_write(const struct rwlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
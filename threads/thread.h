@@ -124,6 +124,8 @@ struct thread
 
     /* FileSYS Stuff*/
     struct dir *current_dir;
+    int journal_depth; /* Nesting of journal_begin() calls. */
+    int journal_used;  /* Sectors logged by the outermost operation. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -1,5 +1,8 @@
 // #include <stdio.h>
 #include <syscall-nr.h>
+#include <limits.h>
+#include <stat.h>
+#include <uio.h>
 
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -21,13 +24,11 @@ void matelo();
 bool valid_ptr(uint8_t *addy, uint8_t byte, int size, uint8_t type_of_call);
 bool valid_ptr_v2(const void *addy);
 bool check_buffer(void *buff_to_check, unsigned size);
-
-static struct lock file_lock; // lock for synch when doing file related stuff
+bool check_iovec(const struct iovec *iov, int iovcnt);
 
 void syscall_init(void)
 {
     intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-    lock_init(&file_lock);
 }
 
 /* Reads a byte at user virtual address UADDR.
@@ -120,16 +121,67 @@ bool valid_ptr_v2(const void *addy)
     return true;
 }
 
+/*
+Validates the SIZE bytes at BUFFER. A page is all user memory or none of
+it, so one address per page is checked instead of every byte. Kills the
+process on a bad pointer
+*/
 bool check_buffer(void *buffer, unsigned size)
 {
-    char *pos = (char *)buffer;
-    for (int i = 0; i < size; i++)
+    uint8_t *pos = (uint8_t *)buffer;
+    uint8_t *last = pos + size - 1;
+
+    if (size == 0)
+    {
+        return true;
+    }
+    if (last < pos)
+    {
+        matelo();
+        return false;
+    }
+    for (; pos <= last; pos = (uint8_t *)pg_round_down(pos) + PGSIZE)
     {
         if (!valid_ptr_v2((const void *)pos))
         {
             return false;
         }
-        pos++;
+    }
+    return true;
+}
+
+/*
+Validates an iovec array of IOVCNT segments and every buffer in it, all at
+once before readv/writev start doing I/O. Kills the process on a bad pointer,
+returns false if IOVCNT is out of range or the lengths add up past INT_MAX
+*/
+bool check_iovec(const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+    {
+        return false;
+    }
+    if (iovcnt == 0)
+    {
+        return true;
+    }
+    if (!check_buffer((void *)iov, iovcnt * sizeof *iov))
+    {
+        return false;
+    }
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len > INT_MAX - total)
+        {
+            return false;
+        }
+        total += iov[i].iov_len;
+        if (iov[i].iov_len > 0 && !check_buffer(iov[i].iov_base, iov[i].iov_len))
+        {
+            return false;
+        }
     }
     return true;
 }
@@ -138,7 +190,6 @@ static void
 syscall_handler(struct intr_frame *f UNUSED)
 {
     log(L_TRACE, "syscall_handler()");
-    /* lock for any file related activity*/
     struct thread *cur = thread_current(); /*current thread calling a system call*/
     uint32_t *esp = f->esp;
     cur->stack_pointer = f->esp;
@@ -159,7 +210,7 @@ syscall_handler(struct intr_frame *f UNUSED)
     uint32_t *arg1 = esp + 2;
     uint32_t *arg2 = esp + 3;
 
-    if (*esp < SYS_HALT || *esp > SYS_INUMBER) // if there is a bad call number
+    if (*esp < SYS_HALT || *esp > SYS_COPY_RANGE) // if there is a bad call number
     {
         matelo(cur);
         return;
@@ -298,10 +349,8 @@ syscall_handler(struct intr_frame *f UNUSED)
             struct file *target = t->file;
             if (target != NULL)
             {
-                lock_acquire(&file_lock);
                 int val = file_length(target);
                 f->eax = val;
-                lock_release(&file_lock);
             }
         }
         else
@@ -621,6 +670,226 @@ syscall_handler(struct intr_frame *f UNUSED)
         f->eax = target->inode;
         break;
     }
+    case SYS_READV:
+    {
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1) || !valid_ptr_v2((const void *)arg2))
+            return;
+        int fd = ((int)*arg0);
+        const struct iovec *iov = ((const struct iovec *)*arg1);
+        int iovcnt = ((int)*arg2);
+        log(L_TRACE, "SYS_READV(fd: [%d], iovcnt: [%d])", fd, iovcnt);
+        if (fd == STDOUT_FILENO || fd < 0 || fd >= MAX_FD)
+        {
+            matelo();
+            return;
+        }
+        /* One check for the whole vector, then one pass over the segments */
+        if (!check_iovec(iov, iovcnt))
+        {
+            f->eax = -1;
+            break;
+        }
+        int total = 0;
+        if (fd == STDIN_FILENO)
+        {
+            for (int i = 0; i < iovcnt; i++)
+            {
+                uint8_t *buffer = iov[i].iov_base;
+                for (size_t j = 0; j < iov[i].iov_len; j++)
+                {
+                    buffer[j] = input_getc();
+                }
+                total += iov[i].iov_len;
+            }
+            f->eax = total;
+            break;
+        }
+        struct file_plus *t = cur->file_descriptor_table_plus[fd];
+        if (t == NULL || t->file == NULL)
+        {
+            matelo();
+            return;
+        }
+        for (int i = 0; i < iovcnt; i++)
+        {
+            off_t got = file_read(t->file, iov[i].iov_base, iov[i].iov_len);
+            total += got;
+            /* End of file */
+            if (got < (off_t)iov[i].iov_len)
+                break;
+        }
+        f->eax = total;
+        break;
+    }
+    case SYS_WRITEV:
+    {
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1) || !valid_ptr_v2((const void *)arg2))
+            return;
+        int fd = ((int)*arg0);
+        const struct iovec *iov = ((const struct iovec *)*arg1);
+        int iovcnt = ((int)*arg2);
+        log(L_TRACE, "SYS_WRITEV(fd: [%d], iovcnt: [%d])", fd, iovcnt);
+        if (fd == STDIN_FILENO || fd < 0 || fd >= MAX_FD)
+        {
+            log(L_ERROR, "Tried to write STDIN");
+            matelo();
+            return;
+        }
+        if (!check_iovec(iov, iovcnt))
+        {
+            f->eax = -1;
+            break;
+        }
+        int total = 0;
+        if (fd == STDOUT_FILENO)
+        {
+            for (int i = 0; i < iovcnt; i++)
+            {
+                putbuf(iov[i].iov_base, iov[i].iov_len); // writes to the console
+                total += iov[i].iov_len;
+            }
+            f->eax = total;
+            break;
+        }
+        struct file_plus *t = cur->file_descriptor_table_plus[fd];
+        if (t == NULL || t->file == NULL)
+        {
+            log(L_ERROR, "File is empty");
+            matelo();
+            return;
+        }
+        if (!strcmp(cur->executing_file, t->name) || !strcmp(cur->parent->executing_file, t->name))
+        {
+            log(L_ERROR, "Tried to write to ELF file");
+            f->eax = 0;
+            break;
+        }
+        if (t->file->inode->data.isDir)
+        {
+            log(L_ERROR, "Tried to write to directory");
+            matelo();
+            return;
+        }
+        for (int i = 0; i < iovcnt; i++)
+        {
+            off_t put = file_write(t->file, iov[i].iov_base, iov[i].iov_len);
+            total += put;
+            /* Disk full */
+            if (put < (off_t)iov[i].iov_len)
+                break;
+        }
+        f->eax = total;
+        break;
+    }
+    case SYS_GETDENTS:
+    {
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1) || !valid_ptr_v2((const void *)arg2))
+            return;
+        int fd = ((int)*arg0);
+        struct dirent *ents = ((struct dirent *)*arg1);
+        unsigned size = ((unsigned)*arg2);
+        log(L_TRACE, "SYS_GETDENTS(fd: [%d], size: [%d])", fd, size);
+        if (fd >= MAX_FD || fd < 0)
+        {
+            matelo();
+            break;
+        }
+        /* As many whole records as fit in the buffer */
+        int max = size / sizeof *ents;
+        if (max > 0 && !check_buffer(ents, max * sizeof *ents))
+            return;
+        struct file_plus *t = cur->file_descriptor_table_plus[fd];
+        if (t == NULL || t->file == NULL)
+        {
+            matelo();
+            break;
+        }
+        struct file *target = t->file;
+        /* 0 means the end, so no room for a record is an error */
+        if (!target->inode->data.isDir || max == 0)
+        {
+            f->eax = -1;
+            break;
+        }
+        struct dir *dir = (struct dir *)target;
+        f->eax = dir_readdir_bulk(dir, ents, max);
+        break;
+    }
+    case SYS_STAT:
+    {
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1))
+            return;
+        char *file = ((char *)*arg0);
+        struct stat *st = ((struct stat *)*arg1);
+        if (!valid_ptr_v2((const void *)file) || !check_buffer(st, sizeof *st))
+            return;
+        log(L_TRACE, "SYS_STAT(file: [%s])", file);
+        f->eax = filesys_stat(file, st);
+        break;
+    }
+    case SYS_FSTAT:
+    {
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1))
+            return;
+        int fd = ((int)*arg0);
+        struct stat *st = ((struct stat *)*arg1);
+        if (!check_buffer(st, sizeof *st))
+            return;
+        log(L_TRACE, "SYS_FSTAT(fd: [%d])", fd);
+        if (fd >= MAX_FD || fd < 0)
+        {
+            matelo();
+            break;
+        }
+        f->eax = false;
+        if (fd == STDIN_FILENO || fd == STDOUT_FILENO)
+            break;
+        struct file_plus *t = cur->file_descriptor_table_plus[fd];
+        if (t == NULL || t->file == NULL)
+        {
+            matelo();
+            break;
+        }
+        inode_stat(t->file->inode, st);
+        f->eax = true;
+        break;
+    }
+    case SYS_COPY_RANGE:
+    {
+        uint32_t *arg3 = esp + 4;
+        uint32_t *arg4 = esp + 5;
+        if (!valid_ptr_v2((const void *)arg0) || !valid_ptr_v2((const void *)arg1) || !valid_ptr_v2((const void *)arg2) ||
+            !valid_ptr_v2((const void *)arg3) || !valid_ptr_v2((const void *)arg4))
+            return;
+        int src_fd = ((int)*arg0);
+        off_t src_ofs = ((off_t)*arg1);
+        int dst_fd = ((int)*arg2);
+        off_t dst_ofs = ((off_t)*arg3);
+        off_t size = ((off_t)*arg4);
+        log(L_TRACE, "SYS_COPY_RANGE(src_fd: [%d], src_ofs: [%d], dst_fd: [%d], dst_ofs: [%d], size: [%d])", src_fd, src_ofs, dst_fd, dst_ofs, size);
+        if (src_fd < 2 || src_fd >= MAX_FD || dst_fd < 2 || dst_fd >= MAX_FD)
+        {
+            matelo();
+            return;
+        }
+        struct file_plus *src = cur->file_descriptor_table_plus[src_fd];
+        struct file_plus *dst = cur->file_descriptor_table_plus[dst_fd];
+        if (src == NULL || src->file == NULL || dst == NULL || dst->file == NULL)
+        {
+            matelo();
+            return;
+        }
+        /* Same rules as SYS_WRITE for the destination */
+        if (!strcmp(cur->executing_file, dst->name) || !strcmp(cur->parent->executing_file, dst->name) ||
+            dst->file->inode->data.isDir || src->file->inode->data.isDir)
+        {
+            f->eax = -1;
+            break;
+        }
+        /* No user buffer to check, the data never leaves the kernel */
+        f->eax = file_copy_range(src->file, src_ofs, dst->file, dst_ofs, size);
+        break;
+    }
     default:
         break;
     }